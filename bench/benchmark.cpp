@@ -0,0 +1,312 @@
+#include "processor.h"
+#include "device.h"
+#include "opcode_profile.h"
+#include "perf_counters.h"
+#include "processor_hooks.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Workloads are raw byte code so the benchmark measures the CPU loop and not the assembler.
+struct Workload
+{
+    std::string name;
+    std::vector<uint8_t> byte_code;
+    int repetitions;
+};
+
+static const std::vector<Workload> WORKLOADS = {
+    // LDA #imm; STA abs pairs, as emitted for programs/hello_world.asm
+    {"lda_sta",
+     {0xA9, 0x48, 0x8D, 0x00, 0x02,
+      0xA9, 0x65, 0x8D, 0x01, 0x02,
+      0xA9, 0x6C, 0x8D, 0x02, 0x02,
+      0xA9, 0x6C, 0x8D, 0x03, 0x02,
+      0xA9, 0x6F, 0x8D, 0x04, 0x02,
+      0x00},
+     200000},
+    // Nested DEX; BNE / DEY; BNE delay loop
+    {"dex_bne",
+     {0xA0, 0x00,
+      0xA2, 0x00,
+      0xCA,
+      0xD0, 0xFD,
+      0x88,
+      0xD0, 0xF8,
+      0x00},
+     40},
+    // CLC; ADC #imm; CMP #imm; BNE counter loop
+    {"adc_cmp_bne",
+     {0xA9, 0x00,
+      0x18,
+      0x69, 0x01,
+      0xC9, 0x00,
+      0xD0, 0xF9,
+      0x00},
+     5000},
+};
+
+// Single steps the workloads through fetch/execute, so no fused sequence hides its opcodes.
+// Repetitions match the timed run so the profile is weighted like the benchmark.
+static void profile_workloads(OpcodeProfile &profile)
+{
+    for (const Workload &workload : WORKLOADS)
+    {
+        auto memory = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+        memory->load_shared(0x8000, workload.byte_code.data(), workload.byte_code.size());
+        Processor cpu(std::move(memory));
+
+        for (int r = 0; r < workload.repetitions; r++)
+        {
+            cpu.reset();
+            cpu.set_PC(0x8000);
+            profile.break_sequence();
+            while (true)
+            {
+                OpCode opcode = cpu.fetch_opcode();
+                if (opcode == OpCode::BRK)
+                {
+                    break;
+                }
+                profile.record(opcode);
+                cpu.execute(opcode);
+                if (cpu.get_fault() != Fault::NONE)
+                {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Host counters summed over every execution of one opcode
+struct OpcodeCounters
+{
+    uint64_t executions = 0;
+    PerfSample totals;
+};
+
+// Smallest cost of an empty read pair, subtracted from every bracketed handler
+static PerfSample read_overhead(const PerfCounters &counters)
+{
+    PerfSample overhead;
+    std::fill(std::begin(overhead.values), std::end(overhead.values), UINT64_MAX);
+    for (int i = 0; i < 1000; i++)
+    {
+        PerfSample before, after;
+        counters.read(before);
+        counters.read(after);
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+        {
+            overhead.values[c] = std::min(overhead.values[c], after.values[c] - before.values[c]);
+        }
+    }
+    return overhead;
+}
+
+// Single steps `workload` like profile_workloads, reading the counters around each handler
+static void attribute_opcodes(const Workload &workload, PerfCounters &counters, std::vector<OpcodeCounters> &opcodes)
+{
+    auto memory = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+    memory->load_shared(0x8000, workload.byte_code.data(), workload.byte_code.size());
+    Processor cpu(std::move(memory));
+
+    opcodes.assign(256, OpcodeCounters());
+    counters.start();
+    PerfSample overhead = read_overhead(counters);
+    for (int r = 0; r < workload.repetitions; r++)
+    {
+        cpu.reset();
+        cpu.set_PC(0x8000);
+        while (true)
+        {
+            OpCode opcode = cpu.fetch_opcode();
+            if (opcode == OpCode::BRK)
+            {
+                break;
+            }
+
+            PerfSample before, after;
+            counters.read(before);
+            cpu.execute(opcode);
+            counters.read(after);
+
+            OpcodeCounters &entry = opcodes[static_cast<uint8_t>(opcode)];
+            entry.executions++;
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+            {
+                uint64_t delta = after.values[c] - before.values[c];
+                entry.totals.values[c] += delta > overhead.values[c] ? delta - overhead.values[c] : 0;
+            }
+            if (cpu.get_fault() != Fault::NONE)
+            {
+                break;
+            }
+        }
+    }
+    counters.stop();
+}
+
+// Counter values divided by `divisor`, null for counters the host does not offer
+static void write_counters(std::ostream &out, const PerfCounters &counters, const PerfSample &sample, uint64_t divisor)
+{
+    out << "{";
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        out << (c ? ", " : "") << "\"" << PerfCounters::name(PerfCounter(c)) << "\": ";
+        if (counters.is_available(PerfCounter(c)) && divisor > 0)
+        {
+            if (divisor == 1)
+            {
+                out << sample.values[c];
+            }
+            else
+            {
+                out << double(sample.values[c]) / divisor;
+            }
+        }
+        else
+        {
+            out << "null";
+        }
+    }
+    out << "}";
+}
+
+// Run `workload` under the hooks policy `spec`, chosen at runtime like emulator --hooks.
+// Returns MIPS.
+static double time_hooked(const Workload &workload, const std::string &spec)
+{
+    auto memory = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+    memory->load_shared(0x8000, workload.byte_code.data(), workload.byte_code.size());
+    Processor cpu(std::move(memory));
+    std::unique_ptr<HookedRunner> runner = make_hooked_runner(spec);
+
+    uint64_t instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < workload.repetitions; r++)
+    {
+        cpu.reset();
+        cpu.set_PC(0x8000);
+        instructions += runner->run(cpu, UINT64_MAX);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return instructions / elapsed.count() / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    // --profile-out writes an opcode sequence profile for superinstruction_gen instead of timing
+    if (argc == 3 && std::string(argv[1]) == "--profile-out")
+    {
+        OpcodeProfile profile;
+        profile_workloads(profile);
+        std::ofstream out(argv[2]);
+        profile.write(out);
+        return out ? 0 : 1;
+    }
+
+    // --perf-opcodes adds a single stepped pass attributing host counters to opcode handlers,
+    // --hooks reruns each workload through the hooks policies
+    bool attribute = false;
+    bool hooks = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--perf-opcodes")
+        {
+            attribute = true;
+        }
+        else if (arg == "--hooks")
+        {
+            hooks = true;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--perf-opcodes] [--hooks] | --profile-out path" << std::endl;
+            return 1;
+        }
+    }
+
+    PerfCounters counters;
+    std::cout << "{\"perf\": {\"available\": " << (counters.any_available() ? "true" : "false")
+              << ", \"fast_read\": " << (counters.has_fast_read() ? "true" : "false")
+              << ", \"error\": \"" << counters.get_error() << "\"}, \"benchmarks\": [";
+
+    for (size_t w = 0; w < WORKLOADS.size(); w++)
+    {
+        const Workload &workload = WORKLOADS[w];
+
+        auto memory = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+        memory->load_shared(0x8000, workload.byte_code.data(), workload.byte_code.size());
+        Processor cpu(std::move(memory));
+
+        uint64_t instructions = 0;
+        PerfSample before, after;
+        counters.start();
+        counters.read(before);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < workload.repetitions; r++)
+        {
+            cpu.reset();
+            cpu.set_PC(0x8000);
+            instructions += cpu.run(UINT64_MAX);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        counters.read(after);
+        counters.stop();
+
+        PerfSample host;
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+        {
+            host.values[c] = after.values[c] - before.values[c];
+        }
+
+        std::cout << (w ? ", " : "") << "{\"name\": \"" << workload.name << "\""
+                  << ", \"instructions\": " << instructions
+                  << ", \"seconds\": " << elapsed.count()
+                  << ", \"mips\": " << (instructions / elapsed.count() / 1e6) << ", \"host\": ";
+        write_counters(std::cout, counters, host, 1);
+        std::cout << ", \"host_per_instruction\": ";
+        write_counters(std::cout, counters, host, instructions);
+
+        // "none" should match mips above: the plain run is the NoHooks instantiation
+        if (hooks)
+        {
+            std::cout << ", \"hooks_mips\": {\"none\": " << time_hooked(workload, "none")
+                      << ", \"count\": " << time_hooked(workload, "count") << "}";
+        }
+
+        if (attribute)
+        {
+            std::vector<OpcodeCounters> opcodes;
+            attribute_opcodes(workload, counters, opcodes);
+
+            std::cout << ", \"opcodes\": [";
+            bool first = true;
+            for (int opcode = 0; opcode < 256; opcode++)
+            {
+                if (opcodes[opcode].executions == 0)
+                {
+                    continue;
+                }
+                char hex[8];
+                snprintf(hex, sizeof(hex), "%02X", opcode);
+                std::cout << (first ? "" : ", ") << "{\"opcode\": \"" << hex << "\", \"executions\": " << opcodes[opcode].executions
+                          << ", \"host_per_execution\": ";
+                write_counters(std::cout, counters, opcodes[opcode].totals, opcodes[opcode].executions);
+                std::cout << "}";
+                first = false;
+            }
+            std::cout << "]";
+        }
+        std::cout << "}";
+    }
+
+    std::cout << "]}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,14 @@
+# Writes OUTPUT defining EMU6502_BUILD_ID, a hash of the library sources under SOURCE_DIR.
+# Run at build time, so any change to the sources gives a new id.
+file(GLOB sources ${SOURCE_DIR}/src/*.cpp ${SOURCE_DIR}/include/*.h ${SOURCE_DIR}/include/*.inc)
+list(SORT sources)
+
+set(hashes "")
+foreach(source IN LISTS sources)
+    file(SHA256 ${source} hash)
+    string(APPEND hashes ${hash})
+endforeach()
+string(SHA256 id "${hashes}")
+string(SUBSTRING ${id} 0 16 id)
+
+file(WRITE ${OUTPUT} "// Generated by cmake/build_id.cmake\nstatic constexpr uint64_t EMU6502_BUILD_ID = 0x${id}ULL;\n")
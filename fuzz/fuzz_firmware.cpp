@@ -0,0 +1,53 @@
+#include "assembler.h"
+#include "fuzz_harness.h"
+#include "logging.h"
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// libFuzzer entry point. The firmware (.asm or raw .bin) is taken from EMU6502_FUZZ_FIRMWARE and
+// loaded at 0x8000. Emulated edge coverage is exported through libFuzzer's extra counters.
+
+__attribute__((section("__libfuzzer_extra_counters"))) static uint8_t emulated_coverage[COVERAGE_MAP_SIZE];
+
+static FuzzHarness *harness = nullptr;
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    const char *path = std::getenv("EMU6502_FUZZ_FIRMWARE");
+    if (!path)
+    {
+        std::cerr << "EMU6502_FUZZ_FIRMWARE is not set" << std::endl;
+        exit(1);
+    }
+
+    current_log_level = LogLevel::LOG_NONE;
+
+    std::vector<uint8_t> firmware;
+    std::string firmware_path = path;
+    if (firmware_path.size() > 4 && firmware_path.substr(firmware_path.size() - 4) == ".asm")
+    {
+        firmware = interpret(firmware_path);
+    }
+    else
+    {
+        std::ifstream file(firmware_path, std::ios::binary);
+        firmware.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    const char *steps = std::getenv("EMU6502_FUZZ_MAX_STEPS");
+    harness = new FuzzHarness(firmware, 0x8000, 0x8000, steps ? std::strtoull(steps, nullptr, 10) : 100000);
+    harness->set_coverage_map(emulated_coverage);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // Anything but a clean run is a crash as far as libFuzzer is concerned
+    if (harness->run(data, size) != FuzzOutcome::OK)
+    {
+        abort();
+    }
+    return 0;
+}
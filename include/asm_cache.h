@@ -0,0 +1,47 @@
+#ifndef __ASM_CACHE_H__
+#define __ASM_CACHE_H__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "byte_code_memory.h"
+
+// On disk cache of assembled programs, shared by every emulator process using the same
+// directory.
+//
+// Images are content addressed: `<key>.img` is named after a hash of the origin and of the
+// contents of the source and every file it includes, and holds the byte code and symbol
+// table. Keys and manifest names also hash the library sources the emulator was built from,
+// so an assembler change never serves images from another build. A per source manifest
+// `<path hash>.dep` records the key with the size and mtime of
+// each file it was built from, so an unchanged program is found with a few stat calls.
+// Both files are written to a temporary name and renamed into place, so readers only ever
+// see complete files and concurrent writers of the same image are harmless.
+
+static constexpr uint32_t ASM_CACHE_VERSION = 1;
+
+class AssemblyCache
+{
+public:
+    // The directory is created on first store
+    AssemblyCache(const std::string &directory);
+
+    // $EMU6502_ASM_CACHE, else $XDG_CACHE_HOME/emu6502, else ~/.cache/emu6502
+    static std::string default_directory();
+
+    // Map the program in `filename`, assembled for `origin`, into `memory`. Cache hits skip
+    // the assembler entirely and, for page aligned origins, map the image's pages straight
+    // from the cache file. Returns false if the program does not assemble.
+    bool load(const std::string &filename, uint16_t origin, ByteCodeMemory &memory,
+              std::map<std::string, uint16_t> *symbols = nullptr, size_t *size = nullptr);
+
+    uint64_t get_hits() const;
+    uint64_t get_misses() const;
+
+private:
+    std::string directory;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+#endif // __ASM_CACHE_H__
@@ -0,0 +1,31 @@
+#ifndef __ASSEMBLER_H__
+#define __ASSEMBLER_H__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Program origin used by interpret and the emulator front end
+static constexpr uint16_t PROGRAM_ORIGIN = 0x8000;
+
+// Output of assemble. `sources` lists the main file followed by every included file in
+// the order they were read, which is what the assembly cache hashes.
+struct Assembly
+{
+    std::vector<uint8_t> byte_code;
+    std::map<std::string, uint16_t> symbols;
+    std::vector<std::string> sources;
+};
+
+// Assemble `filename` for loading at `origin`. Besides instructions a line may hold a
+// `label:` definition, a `; comment` or `.include "path"`, resolved relative to the
+// including file. An absolute operand is a hex address when it reads as one (`D000` or
+// `0xD000`), otherwise it names a label. Returns false if a source could not be read, a
+// label is undefined or an address does not fit 16 bits.
+bool assemble(const std::string &filename, uint16_t origin, Assembly &assembly);
+
+// Assemble the program in `filename` into byte code, ready to be written at 0x8000.
+std::vector<uint8_t> interpret(const std::string &filename);
+
+#endif // __ASSEMBLER_H__
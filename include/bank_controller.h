@@ -0,0 +1,64 @@
+#ifndef __BANK_CONTROLLER_H__
+#define __BANK_CONTROLLER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "device.h"
+
+// A window of the address space the controller maps banks into
+struct BankWindow
+{
+    uint16_t start;    // Must be aligned to the window size
+    bool writable;     // RAM window; writes to read-only windows are dropped
+};
+
+// Bank switching controller over a backing store larger than the address space. Every
+// window shows one window sized bank of the store, and switching only rewrites the page
+// table entries of the window, no data is copied.
+//
+// Registers, relative to the mapped base, for window w:
+//   w        bank number low byte, writing it switches the window
+//   0x10 + w bank number high byte, latched until the next low byte write
+class BankController : public Device
+{
+public:
+    // `window_size` is a multiple of PAGE_SIZE, e.g. 4 or 8 KB. The store holds `bank_count`
+    // zeroed banks; fill it with load before or after attaching.
+    BankController(uint32_t window_size, uint32_t bank_count, const std::vector<BankWindow> &windows);
+
+    // Copy `size` bytes into the store at byte `offset`
+    void load(size_t offset, const uint8_t *bytes, size_t size);
+
+    void connect(ByteCodeMemory *bus) override;
+    const char *get_name() const override { return "bank"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    // Selected banks and latches, plus the contents of every bank that has been mapped into a
+    // writable window. The other banks still hold what the host loaded and are not saved.
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+    // Switch window `window` to `bank`, out of range banks wrap
+    void select(uint32_t window, uint32_t bank);
+    uint32_t get_bank(uint32_t window) const;
+    uint64_t get_switches() const;
+
+private:
+    ByteCodeMemory *bus = nullptr;
+    uint32_t pages_per_window;
+    uint32_t bank_count;
+    std::vector<BankWindow> windows;
+    std::vector<MemoryPage> store;
+    std::vector<uint32_t> selected;
+    std::vector<uint8_t> high_latch;
+    uint64_t switches = 0;
+
+    // Host loaded contents of the banks mapped writable so far, restored when a state from
+    // before their first write is loaded
+    std::map<uint32_t, std::vector<MemoryPage>> pristine;
+};
+
+#endif // __BANK_CONTROLLER_H__
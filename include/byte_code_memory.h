@@ -1,22 +1,187 @@
 #ifndef __BTYE_CODE_MEMORY_H__
 #define __BTYE_CODE_MEMORY_H__
 
+#include <atomic>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 // 64KB of memory
 static constexpr uint32_t MEMORY_SIZE = 1024 * 64;
 
+// Memory is built from 256 byte pages, the same size as a 6502 page
+static constexpr uint32_t PAGE_SIZE = 0x100;
+static constexpr uint32_t PAGE_COUNT = MEMORY_SIZE / PAGE_SIZE;
+
+struct MemoryPage
+{
+    uint8_t bytes[PAGE_SIZE];
+};
+
+// Interns pages by content so identical ROM/program pages are shared between instances.
+// A page leaves the cache when its last user releases it.
+class PageCache
+{
+public:
+    static PageCache &global();
+
+    // Returns the shared page holding `bytes`. The page must never be written.
+    std::shared_ptr<MemoryPage> intern(const uint8_t *bytes);
+
+    // The shared all zero page every memory starts out with
+    static const std::shared_ptr<MemoryPage> &zero_page();
+
+    // Pages currently interned
+    size_t size();
+
+private:
+    struct Entry
+    {
+        MemoryPage *page;
+        std::weak_ptr<MemoryPage> shared;
+    };
+
+    void release(uint64_t hash, MemoryPage *page);
+
+private:
+    std::mutex mutex;
+    std::unordered_multimap<uint64_t, Entry> pages;
+};
+
+class InputLog;
+class MappedFile;
+
+// Page table captured by ByteCodeMemory::snapshot
+struct MemorySnapshot
+{
+    std::shared_ptr<MemoryPage> pages[PAGE_COUNT];
+};
+
+// Reads plus writes seen by one mapped device
+struct DeviceAccesses
+{
+    const char *name; // Device::get_name
+    uint64_t count;
+};
+
 class ByteCodeMemory
 {
 public:
     ByteCodeMemory();
-    ~ByteCodeMemory();
+    virtual ~ByteCodeMemory();
 
     virtual uint8_t read(uint16_t address);
     virtual void write(uint16_t address, uint8_t value);
 
+    // Map `size` bytes at `address` as shared read-only pages. Devices are bypassed and
+    // each page is copied to a private page on its first write.
+    void load_shared(uint16_t address, const uint8_t *bytes, size_t size);
+    // Like load_shared but copies into private pages, for images loaded once such as jobs.
+    // Nothing is interned, so concurrent loads do not contend on the page cache.
+    void load_private(uint16_t address, const uint8_t *bytes, size_t size);
+
+    // Share every page with the returned snapshot. Pages are copied on their next write,
+    // so only pages written since the snapshot differ from it.
+    MemorySnapshot snapshot();
+    // Point the pages changed since `snapshot` back at it. Returns the number of pages restored.
+    size_t restore(const MemorySnapshot &snapshot);
+
+    // Bytes of page data owned by this instance alone
+    size_t private_bytes() const;
+
+    // Direct page access for save states. Pages mapped with map_page are copied on their first write.
+    const uint8_t *get_page(uint32_t page) const;
+    bool is_zero_page(uint32_t page) const;
+    void map_page(uint32_t page, std::shared_ptr<MemoryPage> data);
+
+    // Point `page` at PAGE_SIZE bytes owned by the caller, such as a bank of a banking
+    // controller. Only the page table changes. Writes go to `data` when `writable` and are
+    // dropped otherwise. Snapshots and restores leave external pages alone, their contents
+    // belong to the owner. unmap_external returns the page to regular memory.
+    void map_external(uint32_t page, uint8_t *data, bool writable);
+    void unmap_external(uint32_t page);
+    bool is_external(uint32_t page) const;
+
+    // Bulk transfers straight between pages, as done by DMA. Pages with a device mapped are
+    // accessed byte by byte through read and write, other pages bypass the output port. copy
+    // handles overlapping ranges like memmove and both wrap around at the end of the address space.
+    void copy(uint16_t destination, uint16_t source, size_t size);
+    void fill(uint16_t destination, uint8_t value, size_t size);
+    // Copies between memory and host buffers, for devices that transfer blocks. Device pages
+    // are accessed through read and write like with copy.
+    void write_block(uint16_t destination, const uint8_t *bytes, size_t size);
+    void read_block(uint16_t source, uint8_t *bytes, size_t size);
+
+    // Devices that hold the bus charge the cycles it was busy to the processor's clock
+    void attach_clock(uint64_t *cycles);
+    void charge_cycles(uint64_t cycles);
+    // The attached clock, for devices with latency. 0 without a processor.
+    uint64_t get_cycles() const;
+
+    // Pages written or remapped since the last mark_clean. Marking clean makes the next write
+    // to each page copy it, which is how writes are tracked. Snapshots do not affect it.
+    std::bitset<PAGE_COUNT> dirty_pages() const;
+    void mark_clean();
+
+    // Back the address space with `path`, mapped MAP_SHARED, so other processes can watch and
+    // poke memory live and the contents outlive the process. The current contents are copied
+    // into the file. From then on pages are written in place: loads, restores and map_page
+    // copy into the file and snapshots copy out of it.
+    bool back_with_file(const std::string &path);
+    bool is_file_backed() const;
+    // Flush the backing file so it holds the memory as of this call
+    bool sync();
+
+    // Whether accesses to `page` go to a device rather than memory
+    virtual bool has_device(uint32_t page) const { return false; }
+
+    // Device state is appended to / consumed from a byte stream by memories with devices
+    virtual void save_device_state(std::vector<uint8_t> &out) const {}
+    virtual bool load_device_state(const uint8_t *data, size_t size) { return size == 0; }
+
+    // Reads plus writes seen by each device, in attach order, for monitoring
+    virtual void get_device_accesses(std::vector<DeviceAccesses> &out) const {}
+
+    // Capture characters written to the 0xFF00 output port into `buffer` instead of logging them
+    virtual void set_output(std::string *buffer);
+
+    // Level triggered interrupt request lines, one bit per source. Safe to use from any thread.
+    void raise_irq(uint32_t line);
+    void clear_irq(uint32_t line);
+    bool irq_asserted() const;
+
+    // Device reads and interrupts are recorded to or replayed from `log`, nullptr disables
+    void set_input_log(InputLog *log);
+    InputLog *get_input_log() const;
+
+protected:
+    std::string *output = nullptr;
+    InputLog *input_log = nullptr;
+
 private:
-    uint8_t data[0x8000 + MEMORY_SIZE];
+    uint8_t *make_private(uint32_t page);
+
+private:
+    // Fast path for reads. Only pages marked in private_pages may be written through it.
+    uint8_t *page_data[PAGE_COUNT];
+    std::shared_ptr<MemoryPage> pages[PAGE_COUNT];
+    std::bitset<PAGE_COUNT> private_pages;
+    std::bitset<PAGE_COUNT> dirty;
+    std::shared_ptr<MappedFile> backing;
+
+    // External pages, and which of them take writes
+    std::bitset<PAGE_COUNT> external;
+    std::bitset<PAGE_COUNT> external_writable;
+    uint8_t discard[PAGE_SIZE];
+
+    uint64_t *clock = nullptr;
+
+    std::atomic<uint32_t> irq_lines{0};
 };
 
-#endif // __BTYE_CODE_MEMORY_H__
\ No newline at end of file
+#endif // __BTYE_CODE_MEMORY_H__
@@ -1,15 +1,66 @@
 #ifndef __DEVICE_H__
 #define __DEVICE_H__
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 #include "byte_code_memory.h"
 
-class CharacterDisplayDevice
+// I/O area layout, one 256 byte page per device
+static constexpr uint16_t DISPLAY_BASE = 0xD000;
+static constexpr uint16_t INPUT_BASE = 0xD100;
+static constexpr uint16_t BANK_BASE = 0xD200;
+static constexpr uint16_t DMA_BASE = 0xD300;
+static constexpr uint16_t MATH_BASE = 0xD400;
+static constexpr uint16_t SERIAL_BASE = 0xD500;
+static constexpr uint16_t STORAGE_BASE = 0xD600;
+static constexpr uint16_t FRAMEBUFFER_CONTROL_BASE = 0xD700;
+static constexpr uint16_t FRAMEBUFFER_BASE = 0xE000;
+
+// IRQ lines, as passed to raise_irq/clear_irq
+static constexpr uint32_t SERIAL_IRQ = 1 << 0;
+static constexpr uint32_t STORAGE_IRQ = 1 << 1;
+
+// A memory mapped device. Addresses passed to read and write are absolute.
+class Device
 {
 public:
-    void write(uint16_t address, uint8_t value);
-    uint8_t read(uint16_t address);
+    virtual ~Device() = default;
+
+    // Identifies the device's state in save states
+    virtual const char *get_name() const = 0;
+
+    virtual void write(uint16_t address, uint8_t value) = 0;
+    virtual uint8_t read(uint16_t address) = 0;
+    // Called instead of read while replaying, the value comes from the input log. Devices
+    // whose reads log inputs of their own repeat them here to keep the log in step.
+    virtual void replay_read(uint16_t address) {}
+
+    // Called when the device is attached, for devices that act on memory themselves
+    virtual void connect(ByteCodeMemory *bus) {}
+
+    // Capture output into `buffer` instead of logging it
+    virtual void set_output(std::string *buffer) {}
+
+    // Registers and internal state for save states
+    virtual void save_state(std::vector<uint8_t> &out) const {}
+    virtual bool load_state(const uint8_t *data, size_t size) { return size == 0; }
+};
+
+class CharacterDisplayDevice : public Device
+{
+public:
+    const char *get_name() const override { return "display"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    // Clear is captured as '\f'
+    void set_output(std::string *buffer) override;
+
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
 
 private:
     void display_character(uint8_t ch);
@@ -17,21 +68,69 @@ private:
 
 private:
     uint8_t character;
+    std::string *output = nullptr;
+};
+
+// Feeds a host buffer to the program. Reading base + 0 pops the next byte (0 once drained),
+// base + 1 reads the number of bytes left, clamped to 255.
+class InputBufferDevice : public Device
+{
+public:
+    const char *get_name() const override { return "input"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    // The buffer is not copied and must outlive its use
+    void set_input(const uint8_t *data, size_t size);
+
+    // Only the read position is saved, the buffer belongs to the host
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+private:
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
 };
 
 class ExtendedMemory : public ByteCodeMemory
 {
 public:
+    // Maps the display at DISPLAY_BASE
     ExtendedMemory(std::unique_ptr<CharacterDisplayDevice> device);
 
     virtual uint8_t read(uint16_t address) override;
     virtual void write(uint16_t address, uint8_t value) override;
 
+    virtual void set_output(std::string *buffer) override;
+    virtual bool has_device(uint32_t page) const override;
+
+    // Each device's state is tagged with its name and length prefixed, in attach order. State
+    // saved with other devices attached fails to load with a message naming the mismatch, and
+    // no device is changed unless every device's state loads.
+    virtual void save_device_state(std::vector<uint8_t> &out) const override;
+    virtual bool load_device_state(const uint8_t *data, size_t size) override;
+
+    virtual void get_device_accesses(std::vector<DeviceAccesses> &out) const override;
+
+    // Map `device` over the pages covering [start, end], replacing whatever was mapped there
+    template <typename T>
+    T *attach(std::unique_ptr<T> device, uint16_t start, uint16_t end)
+    {
+        T *mapped = device.get();
+        map_device(std::move(device), start, end);
+        return mapped;
+    }
+    // Also map an attached device over [start, end], for devices with several windows
+    void map_alias(Device *device, uint16_t start, uint16_t end);
+
 private:
-    bool is_device_address(uint16_t address) const;
+    void map_device(std::unique_ptr<Device> device, uint16_t start, uint16_t end);
 
 private:
-    std::unique_ptr<CharacterDisplayDevice> device;
+    std::vector<std::unique_ptr<Device>> devices;
+    Device *device_pages[PAGE_COUNT] = {};
+    uint64_t page_accesses[PAGE_COUNT] = {};
 };
 
-#endif // __DEVICE_H__
\ No newline at end of file
+#endif // __DEVICE_H__
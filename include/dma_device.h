@@ -0,0 +1,53 @@
+#ifndef __DMA_DEVICE_H__
+#define __DMA_DEVICE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "device.h"
+
+enum class DmaMode : uint8_t
+{
+    IDLE,
+    COPY,         // Memory to memory, overlapping ranges are fine
+    FILL,         // Destination set to the fill value
+    FROM_DEVICE,  // Source is a fixed device register read once per byte
+    TO_DEVICE     // Destination is a fixed device register written once per byte
+};
+
+// Block transfers for firmware that would otherwise run LDA/STA copy loops.
+//
+// Registers, relative to the mapped base:
+//   0-1 source, 2-3 destination, 4-5 length (little endian)
+//   6   fill value
+//   7   mode: writing a DmaMode starts the transfer, reading returns the last mode
+//
+// A transfer completes before the writing instruction retires. The bus is held meanwhile,
+// so setup_cycles plus cycles_per_byte for every byte are charged to the processor.
+class DmaDevice : public Device
+{
+public:
+    DmaDevice(uint32_t cycles_per_byte = 1, uint32_t setup_cycles = 4);
+
+    void connect(ByteCodeMemory *bus) override;
+    const char *get_name() const override { return "dma"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+    uint64_t get_transferred() const;
+
+private:
+    void transfer(DmaMode mode);
+
+private:
+    ByteCodeMemory *bus = nullptr;
+    uint32_t cycles_per_byte;
+    uint32_t setup_cycles;
+    uint8_t registers[8] = {};
+    uint64_t transferred = 0;
+};
+
+#endif // __DMA_DEVICE_H__
@@ -0,0 +1,50 @@
+#ifndef __EMU6502_H__
+#define __EMU6502_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C ABI over libemu6502 for embedding in non C++ hosts.
+// A machine is a Processor with 64KB of memory and the character display mapped at 0xD000.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct emu6502_machine emu6502_machine;
+
+    typedef struct emu6502_registers
+    {
+        uint8_t a;
+        uint8_t x;
+        uint8_t y;
+        uint8_t status;
+        uint16_t pc;
+        uint8_t sp;
+    } emu6502_registers;
+
+    emu6502_machine *emu6502_create(void);
+    void emu6502_destroy(emu6502_machine *machine);
+
+    // Copy `size` bytes of byte code to `address`. Returns 0 on success, -1 if it does not fit.
+    int emu6502_load(emu6502_machine *machine, uint16_t address, const uint8_t *data, size_t size);
+    // Assemble `path` and load it at 0x8000. Returns the number of bytes loaded.
+    size_t emu6502_load_asm(emu6502_machine *machine, const char *path);
+
+    // Reset the registers and start execution from `pc`.
+    void emu6502_reset(emu6502_machine *machine, uint16_t pc);
+    // Run until BRK or `max_steps` opcodes. Returns the number of fetched opcodes.
+    uint64_t emu6502_run(emu6502_machine *machine, uint64_t max_steps);
+
+    void emu6502_get_registers(emu6502_machine *machine, emu6502_registers *registers);
+    void emu6502_set_registers(emu6502_machine *machine, const emu6502_registers *registers);
+
+    uint8_t emu6502_read(emu6502_machine *machine, uint16_t address);
+    void emu6502_write(emu6502_machine *machine, uint16_t address, uint8_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __EMU6502_H__
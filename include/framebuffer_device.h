@@ -0,0 +1,76 @@
+#ifndef __FRAMEBUFFER_DEVICE_H__
+#define __FRAMEBUFFER_DEVICE_H__
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "device.h"
+
+static constexpr uint32_t FRAMEBUFFER_WIDTH = 128;
+static constexpr uint32_t FRAMEBUFFER_HEIGHT = 64;
+static constexpr uint32_t FRAMEBUFFER_PITCH = FRAMEBUFFER_WIDTH / 2; // 4 bits per pixel
+static constexpr uint32_t FRAMEBUFFER_SIZE = FRAMEBUFFER_PITCH * FRAMEBUFFER_HEIGHT;
+
+// 128x64 bitmap display with a 16 colour palette.
+//
+// Video memory, FRAMEBUFFER_SIZE bytes at the mapped base: one row after the other, two
+// pixels per byte with the left pixel in the high nibble.
+// Control registers, relative to the control base:
+//   0x00-0x2F palette, R, G, B for each of the 16 colours
+//   0x30      writing ends the current frame now
+//   0x31      frame counter, low byte
+//
+// Writes only mark their row dirty. At the end of each frame, every frame_cycles on the
+// processor clock or when the program ends it explicitly, the dirty rows are converted to
+// the RGBA buffer and the frame is dumped if anything changed. Frames end lazily on the
+// next access or flush, so the device needs no timer and stays deterministic.
+class FramebufferDevice : public Device
+{
+public:
+    // `frame_cycles` of 0 leaves frame ends to the program
+    FramebufferDevice(uint16_t base = FRAMEBUFFER_BASE, uint64_t frame_cycles = 16667);
+
+    void connect(ByteCodeMemory *bus) override;
+    const char *get_name() const override { return "framebuffer"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    // Video memory and palette belong to the device and are saved with it
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+    // Write every changed frame to `directory`/frame_<number>.ppm, empty disables
+    void set_dump_directory(const std::string &directory);
+    // End the frames due by now, and the current one if `end_frame`, e.g. when the program exits
+    void flush(bool end_frame = true);
+
+    // Rendered frame, FRAMEBUFFER_WIDTH x FRAMEBUFFER_HEIGHT pixels of 0xAABBGGRR
+    const uint32_t *get_rgba() const;
+    uint64_t get_frame() const;
+    // Rows converted so far, to check that unchanged rows are not rendered again
+    uint64_t get_rows_rendered() const;
+
+private:
+    void catch_up();
+    void end_frame();
+    bool dump(const std::string &path) const;
+
+private:
+    ByteCodeMemory *bus = nullptr;
+    uint16_t base;
+    uint64_t frame_cycles;
+    uint64_t next_frame;
+    uint64_t frame = 0;
+    uint64_t rows_rendered = 0;
+    std::string dump_directory;
+
+    uint8_t video[FRAMEBUFFER_SIZE] = {};
+    uint8_t palette[16 * 3];
+    std::bitset<FRAMEBUFFER_HEIGHT> dirty_rows;
+    bool changed = false; // Since the last dump
+    std::vector<uint32_t> rgba;
+};
+
+#endif // __FRAMEBUFFER_DEVICE_H__
@@ -0,0 +1,48 @@
+#ifndef __FUZZ_HARNESS_H__
+#define __FUZZ_HARNESS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "byte_code_memory.h"
+#include "device.h"
+#include "processor.h"
+
+enum class FuzzOutcome
+{
+    OK,
+    UNKNOWN_OPCODE,
+    STACK_OVERFLOW,
+    STACK_UNDERFLOW,
+    TIMEOUT
+};
+
+// Persistent mode harness: the firmware is loaded once and every input runs from the same
+// snapshot. Inputs are fed through an InputBufferDevice at INPUT_BASE and only the pages
+// dirtied by the previous input are restored between runs.
+class FuzzHarness
+{
+public:
+    FuzzHarness(const std::vector<uint8_t> &firmware, uint16_t load_address, uint16_t entry, uint64_t max_steps);
+
+    FuzzOutcome run(const uint8_t *data, size_t size);
+
+    // Edge coverage is accumulated into `map` (COVERAGE_MAP_SIZE bytes), e.g. an AFL shared
+    // memory segment or libFuzzer extra counters. Defaults to an internal bitmap.
+    void set_coverage_map(uint8_t *map);
+    uint8_t *get_coverage_map();
+
+private:
+    Processor cpu;
+    ExtendedMemory *memory;
+    InputBufferDevice *input;
+
+    MemorySnapshot initial_memory;
+    Registers initial_registers;
+    uint64_t max_steps;
+
+    std::vector<uint8_t> coverage;
+    uint8_t *coverage_map;
+};
+
+#endif // __FUZZ_HARNESS_H__
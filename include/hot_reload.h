@@ -0,0 +1,62 @@
+#ifndef __HOT_RELOAD_H__
+#define __HOT_RELOAD_H__
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include "assembler.h"
+
+class ByteCodeMemory;
+class Processor;
+
+// Watches a program's sources and patches the reassembled program into a running machine.
+//
+// The directories holding the sources are watched with inotify, so editors saving by
+// renaming a new file over the old one are seen as well. A reload assembles the program
+// again and writes only the bytes that differ from the previously loaded image; the rest of
+// memory, including data the program keeps inside its own image, is left alone. Code is
+// always fetched from memory, so there is no predecoded copy to invalidate, and patched
+// pages that were shared become private copies like any other write.
+class HotReloader
+{
+public:
+    HotReloader(const std::string &filename, uint16_t origin);
+    ~HotReloader();
+    HotReloader(const HotReloader &) = delete;
+
+    // Assemble the program into `memory` and start watching its sources
+    bool load(ByteCodeMemory &memory);
+
+    // Wait up to `timeout_ms`, -1 for ever, for a source to change. Returns true if one did.
+    bool wait(int timeout_ms);
+
+    // Reassemble and patch the changes into the CPU's memory. The CPU restarts at the
+    // restart label, or at the origin if it had stopped, with its registers reset; otherwise
+    // it continues where it was. Returns false, keeping the running image, if the program no
+    // longer assembles.
+    bool reload(Processor &cpu);
+
+    void set_restart_label(const std::string &label);
+    const std::map<std::string, uint16_t> &get_symbols() const;
+    uint32_t get_reloads() const;
+    uint64_t get_patched_bytes() const;
+
+private:
+    void watch_sources();
+
+private:
+    std::string filename;
+    uint16_t origin;
+    std::string restart_label;
+    Assembly image;
+
+    int inotify_fd;
+    std::map<int, std::string> directories; // Watch descriptor to directory
+    std::set<std::string> sources;
+
+    uint32_t reloads;
+    uint64_t patched_bytes;
+};
+
+#endif // __HOT_RELOAD_H__
@@ -0,0 +1,55 @@
+#ifndef __INPUT_LOG_H__
+#define __INPUT_LOG_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Every nondeterministic input a run sees: values returned by device reads, the cycles at
+// which interrupts were taken, values provided by the host and blocks devices copied into
+// memory on their own. Recording appends to the log,
+// replaying serves the logged values in order instead of asking the devices.
+class InputLog
+{
+public:
+    struct Position
+    {
+        size_t device_reads;
+        size_t interrupts;
+        size_t host_values;
+        size_t block_bytes;
+    };
+
+    bool is_replaying() const;
+    // Switching to recording drops anything logged past the current position
+    void set_replaying(bool replay);
+
+    Position get_position() const;
+    void seek(const Position &position);
+
+    // Returns false when there is no logged value left to replay
+    bool replay_device_read(uint8_t &value);
+    void record_device_read(uint8_t value);
+
+    // Whether to take an interrupt at `cycle`, given the live state of the IRQ lines
+    bool interrupt(uint64_t cycle, bool asserted);
+
+    uint64_t host_value(uint64_t live);
+
+    // Replays fill `bytes` from the log, recordings log them. Returns false when replaying
+    // past the end of the log, leaving `bytes` alone.
+    bool block(uint8_t *bytes, size_t size);
+
+    size_t size_bytes() const;
+
+private:
+    bool replaying = false;
+    Position position = {};
+
+    std::vector<uint8_t> device_reads;
+    std::vector<uint64_t> interrupts;
+    std::vector<uint64_t> host_values;
+    std::vector<uint8_t> blocks;
+};
+
+#endif // __INPUT_LOG_H__
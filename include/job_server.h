@@ -0,0 +1,127 @@
+#ifndef __JOB_SERVER_H__
+#define __JOB_SERVER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Long running emulation server. Clients connect to a Unix domain socket and send binary
+// jobs, which run on a pool of pre-allocated machines and are answered with the captured
+// output and the final registers.
+//
+// Every message is a fixed header in host byte order followed by its payload. Requests may
+// be pipelined on one connection, responses carry the request's job id and arrive in
+// completion order.
+//
+//   request:  JobRequestHeader, image_size bytes of byte code, input_size bytes of input
+//   response: JobResponseHeader, output_size bytes of output
+//
+// The image is mapped at load_address and run from entry until BRK, a fault, max_cycles
+// (0 for no limit) or timeout_ms of run time (0 for no limit). Input is served by an
+// InputBufferDevice at INPUT_BASE, output is what the display and 0xFF00 port received.
+
+struct JobRequestHeader
+{
+    char magic[4];
+    uint32_t job_id;
+    uint64_t max_cycles;
+    uint32_t timeout_ms;
+    uint32_t image_size;
+    uint32_t input_size;
+    uint16_t load_address;
+    uint16_t entry;
+};
+
+enum class JobStatus : uint8_t
+{
+    HALTED,       // Reached BRK
+    FAULT,        // Unknown opcode or stack fault
+    CYCLE_BUDGET, // max_cycles executed
+    TIMEOUT,      // timeout_ms elapsed
+    REJECTED      // Image does not fit in memory
+};
+
+struct JobResponseHeader
+{
+    char magic[4];
+    uint32_t job_id;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint32_t output_size;
+    uint16_t PC;
+    JobStatus status;
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t flags;
+    uint8_t SP;
+    uint8_t reserved[4];
+};
+
+static constexpr char JOB_REQUEST_MAGIC[4] = {'E', '6', '5', 'J'};
+static constexpr char JOB_RESPONSE_MAGIC[4] = {'E', '6', '5', 'R'};
+
+struct JobServerOptions
+{
+    std::string socket_path;
+    unsigned workers = 0;       // Pre-warmed machines, 0 uses every core
+    size_t queue_depth = 256;   // Queued jobs before connections stop being read
+    size_t cache_bytes = 0;     // Budget of the result cache, 0 runs every job
+    std::string cache_path;     // Result cache loaded on start and saved on stop, if set
+};
+
+class ResultCache;
+
+class JobServer
+{
+public:
+    JobServer(const JobServerOptions &options);
+    ~JobServer();
+
+    // Listen and serve until stop. Returns false if the socket could not be bound.
+    bool run();
+    // Stop accepting, finish the queued jobs and make run return. Safe from any thread.
+    void stop();
+
+private:
+    struct Connection;
+    struct Job;
+    struct Machine;
+
+    void serve_connection(std::shared_ptr<Connection> connection);
+    void work(Machine &machine);
+    void execute(Machine &machine, Job &job);
+
+    // Blocks while the queue is full, which stops the connection being read. Returns false
+    // when the server is stopping.
+    bool enqueue(std::vector<std::unique_ptr<Job>> &batch);
+    std::unique_ptr<Job> dequeue();
+
+private:
+    JobServerOptions options;
+    std::unique_ptr<ResultCache> cache;
+    int listen_fd;
+    std::atomic<bool> stopping;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_not_empty;
+    std::condition_variable queue_not_full;
+    std::deque<std::unique_ptr<Job>> queue;
+
+    // One reader thread per connection, joined once its connection is gone
+    struct Reader
+    {
+        std::thread thread;
+        std::weak_ptr<Connection> connection;
+    };
+    std::mutex readers_mutex;
+    std::vector<Reader> readers;
+};
+
+#endif // __JOB_SERVER_H__
@@ -5,12 +5,14 @@
 
 enum class LogLevel
 {
+    LOG_NONE,
     LOG_WARN,
     LOG_INFO,
     LOG_DEBUG
 };
 
-static constexpr LogLevel current_log_level = LogLevel::LOG_DEBUG;
+// Set before starting worker threads, e.g. LOG_NONE when output is captured
+inline LogLevel current_log_level = LogLevel::LOG_DEBUG;
 
 #define LOG_COLOR_RESET "\033[0m"
 
@@ -0,0 +1,42 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "byte_code_memory.h"
+
+// A whole file mapped into memory. Pages handed out by `page` keep the mapping alive, so
+// memory can point straight into the file.
+class MappedFile
+{
+public:
+    // Map read-only and copy-on-write. Returns nullptr if the file cannot be opened, is empty
+    // or cannot be mapped.
+    static std::shared_ptr<MappedFile> open(const std::string &path);
+    // Map read-write with MAP_SHARED, creating the file or resizing it to `size`. Writes are
+    // visible to every process mapping the file and are written back to it.
+    static std::shared_ptr<MappedFile> open_shared(const std::string &path, size_t size);
+
+    MappedFile(uint8_t *data, size_t size);
+    MappedFile(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const uint8_t *data() const;
+    // Only mappings from open_shared may be written
+    uint8_t *data();
+    size_t size() const;
+
+    // Write dirty pages of a shared mapping back to the file, waiting for completion
+    bool sync();
+
+    // The PAGE_SIZE bytes at `offset`, which must lie within the file, for ByteCodeMemory::map_page
+    static std::shared_ptr<MemoryPage> page(const std::shared_ptr<MappedFile> &file, size_t offset);
+
+private:
+    uint8_t *bytes;
+    size_t length;
+};
+
+#endif // __MAPPED_FILE_H__
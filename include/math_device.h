@@ -0,0 +1,73 @@
+#ifndef __MATH_DEVICE_H__
+#define __MATH_DEVICE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "device.h"
+
+enum class MathCommand : uint8_t
+{
+    NONE,
+    MULTIPLY,  // result = A[0:15] * B
+    DIVIDE,    // result = A / B, remainder = A % B
+    CRC32,     // result = CRC-32 of B bytes at address A[0:15]
+    CHECKSUM   // result = Fletcher-16 of B bytes at address A[0:15]
+};
+
+// Cycles from a command until its result is visible
+struct MathLatency
+{
+    uint32_t multiply = 8;
+    uint32_t divide = 16;
+    uint32_t block_setup = 4;    // CRC32 and checksum, plus per_byte for every byte
+    uint32_t per_byte = 1;
+};
+
+// Multiply, divide and checksums for firmware without shift-and-add loops.
+//
+// Registers, relative to the mapped base, little endian:
+//   0-3   operand A
+//   4-5   operand B
+//   8-11  result
+//   12-13 remainder
+//   14    command: writing a MathCommand starts it
+//   15    status: bit 7 busy, bit 0 division by zero
+//
+// Results are computed at once but only replace the result registers once the command's
+// latency has elapsed on the processor's clock, so programs see the same timing on every
+// host. Dividing by zero sets the flag, the quotient to 0xFFFFFFFF and the remainder to A.
+class MathDevice : public Device
+{
+public:
+    MathDevice(const MathLatency &latency = {});
+
+    void connect(ByteCodeMemory *bus) override;
+    const char *get_name() const override { return "math"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+private:
+    void start(MathCommand command);
+    // Publish the pending result once it is due
+    void settle();
+
+    uint32_t crc32(uint16_t address, uint16_t size) const;
+    uint16_t fletcher16(uint16_t address, uint16_t size) const;
+
+private:
+    ByteCodeMemory *bus = nullptr;
+    MathLatency latency;
+
+    uint8_t registers[16] = {};
+    uint32_t pending_result = 0;
+    uint16_t pending_remainder = 0;
+    uint8_t pending_status = 0;
+    uint64_t ready_at = 0;
+    bool busy = false;
+};
+
+#endif // __MATH_DEVICE_H__
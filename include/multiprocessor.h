@@ -0,0 +1,86 @@
+#ifndef __MULTIPROCESSOR_H__
+#define __MULTIPROCESSOR_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "device.h"
+#include "processor.h"
+
+// RAM visible to several cores, accessed with relaxed atomic byte loads and stores
+class SharedRegion
+{
+public:
+    explicit SharedRegion(size_t size);
+
+    uint8_t read(size_t offset) const;
+    void write(size_t offset, uint8_t value);
+    size_t size() const;
+
+private:
+    std::unique_ptr<std::atomic<uint8_t>[]> bytes;
+    size_t length;
+};
+
+// Maps a SharedRegion into one core's address space. Only the pages covered by the window
+// take the atomic path, the rest of the core's RAM stays private.
+class SharedWindowDevice : public Device
+{
+public:
+    SharedWindowDevice(std::shared_ptr<SharedRegion> region, uint16_t base);
+
+    const char *get_name() const override { return "shared window"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+private:
+    std::shared_ptr<SharedRegion> region;
+    uint16_t base;
+};
+
+// Reusable barrier that runs `completion` on the last thread to arrive, before releasing the rest
+class CycleBarrier
+{
+public:
+    CycleBarrier(size_t count, std::function<void()> completion);
+
+    void arrive_and_wait();
+
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    size_t count;
+    size_t waiting = 0;
+    uint64_t generation = 0;
+    std::function<void()> completion;
+};
+
+// Several cores on host threads, synchronised every `quantum` cycles. Smaller quanta keep the
+// cores closer together at the cost of more barrier waits. A quantum of 0 is taken as 1.
+class Multiprocessor
+{
+public:
+    explicit Multiprocessor(uint64_t quantum);
+
+    // The core starts executing at `entry`. Returns its index.
+    size_t add_core(std::unique_ptr<ExtendedMemory> memory, uint16_t entry);
+    Processor &core(size_t index);
+
+    // Map `region` at `start` in the address space of core `index`. Returns false, mapping
+    // nothing, if the region is empty or runs past the end of memory.
+    bool share(size_t index, std::shared_ptr<SharedRegion> region, uint16_t start);
+
+    // Run until every core halted or faulted, or until `max_cycles`. Returns the cycles executed.
+    uint64_t run(uint64_t max_cycles);
+
+private:
+    uint64_t quantum;
+    std::vector<std::unique_ptr<Processor>> cores;
+    std::vector<ExtendedMemory *> memories;
+};
+
+#endif // __MULTIPROCESSOR_H__
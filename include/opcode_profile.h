@@ -0,0 +1,35 @@
+#ifndef __OPCODE_PROFILE_H__
+#define __OPCODE_PROFILE_H__
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "processor.h"
+
+// Counts executed opcode pairs and triples. The written profile feeds superinstruction_gen,
+// which picks the sequences fused into superinstructions.inc.
+//
+// Profile format, one sequence per line:
+//   2 A9 8D 1000000
+//   3 18 69 C9 250000
+class OpcodeProfile
+{
+public:
+    OpcodeProfile();
+
+    // Count `opcode` as following the previously recorded ones
+    void record(OpCode opcode);
+    // Forget the preceding opcodes, e.g. after a reset, so no sequence spans two runs
+    void break_sequence();
+
+    void write(std::ostream &out) const;
+
+private:
+    std::vector<uint64_t> pairs; // 256 x 256, indexed by first << 8 | second
+    std::unordered_map<uint32_t, uint64_t> triples;
+    int history; // Opcodes of the current sequence seen so far, capped at 2
+    uint8_t previous[2];
+};
+
+#endif // __OPCODE_PROFILE_H__
@@ -0,0 +1,41 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <cstdint>
+#include "processor.h"
+
+struct PacingStats
+{
+    uint64_t slices = 0;
+    uint64_t missed_deadlines = 0; // Slices that finished after their deadline
+    uint64_t resyncs = 0;          // Times the schedule was dropped instead of caught up
+    double mean_lateness_us = 0;   // Wake up time past the deadline
+    double jitter_us = 0;          // Standard deviation of the lateness
+    double max_lateness_us = 0;
+    double drift_us = 0;           // Wall clock minus emulated time at the end, excluding dropped time
+    double dropped_us = 0;         // Wall time given up by resyncs
+};
+
+// Runs the CPU at a fixed clock rate. Slices of `slice_cycles` run flat out, then the thread
+// sleeps until the slice's monotonic deadline minus `spin_us` and spins for the remainder.
+// Falling more than `resync_us` behind restarts the schedule from now rather than bursting
+// to catch up. A `slice_cycles` of 0 is taken as 1.
+class Pacer
+{
+public:
+    Pacer(double clock_hz, uint64_t slice_cycles, double spin_us = 100, double resync_us = 20000);
+
+    // Run until `cpu` halts or faults, or `max_cycles` were executed. Returns the cycles executed.
+    uint64_t run(Processor &cpu, uint64_t max_cycles);
+
+    const PacingStats &get_stats() const;
+
+private:
+    double clock_hz;
+    uint64_t slice_cycles;
+    int64_t spin_ns;
+    int64_t resync_ns;
+    PacingStats stats;
+};
+
+#endif // __PACER_H__
@@ -0,0 +1,59 @@
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <cstdint>
+#include <string>
+
+// Host hardware counters of the calling thread, for tuning the interpreter itself
+enum PerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+struct PerfSample
+{
+    uint64_t values[PERF_COUNTER_COUNT] = {};
+};
+
+// perf_event_open counters for user space of the calling thread. Counters the kernel or the
+// machine does not offer (no PMU in a VM, perf_event_paranoid, not Linux) are left out:
+// reads report 0 for them and is_available tells them apart, nothing fails.
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool is_available(PerfCounter counter) const;
+    bool any_available() const;
+    // Why counters are missing, empty when all opened
+    const std::string &get_error() const;
+    static const char *name(PerfCounter counter);
+
+    // Counting is off until start
+    void start();
+    void stop();
+
+    // Running totals. Uses rdpmc without a system call when the kernel allows it, which is
+    // cheap enough to bracket a single opcode handler.
+    void read(PerfSample &sample) const;
+    bool has_fast_read() const;
+
+private:
+    uint64_t read_counter(int counter) const;
+
+private:
+    int fds[PERF_COUNTER_COUNT];
+    void *pages[PERF_COUNTER_COUNT]; // perf_event_mmap_page per counter, for rdpmc
+    int leader;
+    bool fast_read;
+    std::string error;
+};
+
+#endif // __PERF_COUNTERS_H__
@@ -2,9 +2,14 @@
 #define __PROCESSOR_H__
 
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <vector>
 #include "byte_code_memory.h"
 
+class Processor;
+class StateExporter;
+
 enum class OpCode
 {
     // Load/Store Operations
@@ -101,7 +106,57 @@ enum class OpCode
     // System Functions
     BRK = 0x00,
     NOP = 0xEA,
-    RTI = 0x40
+    RTI = 0x40,
+
+    // Emulator extensions, taken from the NMOS JAM opcodes
+    HOST_CALL = 0x02 // Operand: host call id
+};
+
+// Conditions that stop execution, reported as crashes by the fuzzing harness
+enum class Fault
+{
+    NONE,
+    UNKNOWN_OPCODE,
+    STACK_OVERFLOW,
+    STACK_UNDERFLOW
+};
+
+// Size of the AFL style edge coverage bitmap
+static constexpr uint32_t COVERAGE_MAP_SIZE = 1 << 16;
+
+// A native routine run by HOST_CALL. It may read and change the registers and memory of
+// `cpu` and returns the cycles it took, charged on top of the opcode's own 2.
+using HostCall = std::function<uint32_t(Processor &cpu)>;
+
+// Instrumentation policy for the templated Processor::step and run. The hooks are called
+// straight from the instruction handlers of the instantiation using them, so a policy
+// costs exactly what its hooks do and NoHooks compiles to the plain interpreter. Policies
+// derive from NoHooks and hide the hooks they need; the ones shipped with the library and a
+// factory choosing one at runtime are in processor_hooks.h.
+struct NoHooks
+{
+    // Opcode fetched at `address`, before it runs. Fused superinstructions fetch too.
+    void on_fetch(uint16_t /* address */, OpCode /* opcode */) {}
+    // Data accesses of instructions and the stack; opcode and operand fetches are not
+    // included. Writes are reported before they reach memory.
+    void on_read(uint16_t /* address */, uint8_t /* value */) {}
+    void on_write(uint16_t /* address */, uint8_t /* value */) {}
+    // Branches, jumps, calls, returns, BRK and interrupts, from the address of the
+    // instruction (the interrupted one for IRQs). `taken` is false for branches falling through.
+    void on_branch(uint16_t /* from */, uint16_t /* to */, bool /* taken */) {}
+    // After each instruction, with the cycle counter
+    void on_cycle(uint64_t /* cycles */) {}
+};
+
+// Snapshot of the programmer visible registers
+struct Registers
+{
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t status;
+    uint16_t PC;
+    uint8_t SP;
 };
 
 class Processor
@@ -115,6 +170,44 @@ public:
     void reset();
     void execute(OpCode opcode);
 
+    // Take a pending IRQ, then fetch and execute one instruction. Returns false once BRK is
+    // fetched or a fault is raised.
+    bool step();
+    // Step until BRK, a fault or until max_steps opcodes were fetched. Returns the number of fetched opcodes.
+    uint64_t run(uint64_t max_steps);
+    // step and run calling `hooks` along the way; the plain ones are the NoHooks
+    // instantiations. Instantiated for the policies in processor_hooks.h.
+    template <typename Hooks>
+    bool step(Hooks &hooks);
+    template <typename Hooks>
+    uint64_t run(uint64_t max_steps, Hooks &hooks);
+    // Instructions retired by step (BRK included) or execute since construction
+    uint64_t get_instructions() const;
+    // True once BRK was fetched, until the next reset or set_PC
+    bool is_halted() const;
+    Fault get_fault() const;
+    // Cycles executed since construction, reset does not clear it
+    uint64_t get_cycles() const;
+    void set_cycles(uint64_t new_cycles);
+    // IRQs taken since construction
+    uint64_t get_interrupts() const;
+
+    // Restoring registers also clears the halted and fault state
+    Registers get_registers() const;
+    void set_registers(const Registers &registers);
+
+    // Record edges taken by branches, JMP and JSR into a COVERAGE_MAP_SIZE bitmap, nullptr disables
+    void set_coverage_map(uint8_t *map);
+    // Publish registers and counters to `exporter` every `interval` instructions, nullptr disables
+    void set_state_exporter(StateExporter *exporter, uint64_t interval);
+    ByteCodeMemory &get_memory();
+
+    // Run `call` for HOST_CALL `id`. Unregistered ids fault like unknown opcodes.
+    void register_host_call(uint8_t id, HostCall call);
+    // Overwrite the routine at `address` with HOST_CALL `id` followed by RTS, so the existing
+    // JSRs to it run the native routine instead
+    void install_host_call(uint16_t address, uint8_t id);
+
 private:
     // Helper methods to manipulate flags
     enum StatusFlag : uint8_t;
@@ -122,6 +215,34 @@ private:
     void set_flag(StatusFlag flag, bool value);
     void update_zero_and_negative_flags(uint8_t value);
 
+    // Data accesses, reported to the hooks
+    template <typename Hooks>
+    uint8_t load(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void store(Hooks &hooks, uint16_t address, uint8_t value);
+
+    // Stack helpers, raising a fault when SP wraps
+    template <typename Hooks>
+    void push(Hooks &hooks, uint8_t value);
+    template <typename Hooks>
+    uint8_t pull(Hooks &hooks);
+
+    void record_edge(uint16_t target);
+    void host_call(uint8_t id);
+    void export_state();
+
+    // Push PC and status and jump through the IRQ vector
+    template <typename Hooks>
+    void interrupt(Hooks &hooks);
+
+    // Superinstructions: fused handlers for frequent opcode sequences
+    template <typename Hooks>
+    inline void dispatch(Hooks &hooks, OpCode opcode);
+    template <typename Hooks>
+    bool execute_superinstruction(Hooks &hooks, OpCode opcode);
+    template <typename Hooks>
+    bool fuse_next(Hooks &hooks, OpCode opcode);
+
     // Addressing modes
     uint8_t immediate();
     uint8_t zero_page();
@@ -131,9 +252,12 @@ private:
     void LDA(uint8_t value);
     void LDX(uint8_t value);
     void LDY(uint8_t value);
-    void STA(uint16_t address);
-    void STX(uint16_t address);
-    void STY(uint16_t address);
+    template <typename Hooks>
+    void STA(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void STX(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void STY(Hooks &hooks, uint16_t address);
 
     void TAX();
     void TAY();
@@ -142,10 +266,14 @@ private:
     void TSX();
     void TXS();
 
-    void PHA();
-    void PHP();
-    void PLA();
-    void PLP();
+    template <typename Hooks>
+    void PHA(Hooks &hooks);
+    template <typename Hooks>
+    void PHP(Hooks &hooks);
+    template <typename Hooks>
+    void PLA(Hooks &hooks);
+    template <typename Hooks>
+    void PLP(Hooks &hooks);
 
     void AND(uint8_t value);
     void EOR(uint8_t value);
@@ -158,23 +286,33 @@ private:
     void CPX(uint8_t value);
     void CPY(uint8_t value);
 
-    void INC(uint16_t address);
+    template <typename Hooks>
+    void INC(Hooks &hooks, uint16_t address);
     void INX();
     void INY();
-    void DEC(uint16_t address);
+    template <typename Hooks>
+    void DEC(Hooks &hooks, uint16_t address);
     void DEX();
     void DEY();
 
-    void ASL(uint16_t address);
-    void LSR(uint16_t address);
-    void ROL(uint16_t address);
-    void ROR(uint16_t address);
+    template <typename Hooks>
+    void ASL(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void LSR(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void ROL(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void ROR(Hooks &hooks, uint16_t address);
 
-    void JMP(uint16_t address);
-    void JSR(uint16_t address);
-    void RTS();
+    template <typename Hooks>
+    void JMP(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void JSR(Hooks &hooks, uint16_t address);
+    template <typename Hooks>
+    void RTS(Hooks &hooks);
 
-    void branch_if(bool condition);
+    template <typename Hooks>
+    void branch_if(Hooks &hooks, bool condition);
 
     void CLC();
     void SEC();
@@ -184,9 +322,11 @@ private:
     void CLD();
     void SED();
 
-    void BRK();
+    template <typename Hooks>
+    void BRK(Hooks &hooks);
     void NOP();
-    void RTI();
+    template <typename Hooks>
+    void RTI(Hooks &hooks);
 
 private:
     std::unique_ptr<ByteCodeMemory> memory;
@@ -199,6 +339,21 @@ private:
     uint16_t PC;    // Program counter
     uint8_t SP;     // Stack pointer
 
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t interrupts;
+    bool halted;
+    Fault fault;
+
+    uint8_t *coverage;
+    uint16_t previous_location;
+
+    StateExporter *exporter;
+    uint64_t export_interval;
+    uint64_t next_export; // Instruction count of the next publish, UINT64_MAX when disabled
+
+    std::vector<HostCall> host_calls; // Indexed by id, empty until the first registration
+
     enum StatusFlag : uint8_t
     {
         CARRY = (1 << 0),
@@ -212,4 +367,8 @@ private:
     };
 };
 
+// The plain interpreter, instantiated once in processor.cpp
+extern template bool Processor::step(NoHooks &);
+extern template uint64_t Processor::run(uint64_t, NoHooks &);
+
 #endif // __PROCESSOR_H__
\ No newline at end of file
@@ -0,0 +1,118 @@
+#ifndef __PROCESSOR_HOOKS_H__
+#define __PROCESSOR_HOOKS_H__
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include "opcode_profile.h"
+#include "processor.h"
+
+// Hooks policies instantiated with Processor::step and run. Each instantiation is its own
+// copy of the interpreter, so the checks below are only paid by runs that asked for them.
+
+// Totals of what a run did
+struct CountingHooks : NoHooks
+{
+    void on_fetch(uint16_t, OpCode) { fetches++; }
+    void on_read(uint16_t, uint8_t) { reads++; }
+    void on_write(uint16_t, uint8_t) { writes++; }
+    void on_branch(uint16_t, uint16_t, bool taken)
+    {
+        branches++;
+        taken_branches += taken;
+    }
+
+    uint64_t fetches = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t branches = 0;
+    uint64_t taken_branches = 0;
+};
+
+// Feeds every executed opcode but BRK to an OpcodeProfile, for --profile-out
+struct ProfileHooks : NoHooks
+{
+    ProfileHooks(OpcodeProfile &profile) : profile(profile) {}
+
+    void on_fetch(uint16_t, OpCode opcode)
+    {
+        if (opcode != OpCode::BRK)
+        {
+            profile.record(opcode);
+        }
+    }
+
+    OpcodeProfile &profile;
+};
+
+// One line per instruction: address, opcode, data accesses and the cycle count after it,
+// e.g. "8000 8D w0200=48 c=6"
+class TraceHooks : public NoHooks
+{
+public:
+    TraceHooks(std::ostream &out);
+    ~TraceHooks();
+
+    void on_fetch(uint16_t address, OpCode opcode);
+    void on_read(uint16_t address, uint8_t value);
+    void on_write(uint16_t address, uint8_t value);
+    void on_cycle(uint64_t cycles);
+
+private:
+    void end_line();
+
+    std::ostream &out;
+    bool open_line;
+};
+
+// Logs every access to [start, end] with the address of the instruction making it
+class WatchHooks : public NoHooks
+{
+public:
+    WatchHooks(uint16_t start, uint16_t end);
+
+    void on_fetch(uint16_t address, OpCode) { instruction = address; }
+    void on_read(uint16_t address, uint8_t value)
+    {
+        if (address >= start && address <= end)
+        {
+            hit(address, value, false);
+        }
+    }
+    void on_write(uint16_t address, uint8_t value)
+    {
+        if (address >= start && address <= end)
+        {
+            hit(address, value, true);
+        }
+    }
+
+    uint64_t get_hits() const;
+
+private:
+    void hit(uint16_t address, uint8_t value, bool write);
+
+    uint16_t start;
+    uint16_t end;
+    uint16_t instruction;
+    uint64_t hits;
+};
+
+// Runs a processor under a hooks policy chosen at runtime. Only the choice is virtual, each
+// run is the policy's own instantiation of the interpreter.
+class HookedRunner
+{
+public:
+    virtual ~HookedRunner() = default;
+    // Like Processor::run
+    virtual uint64_t run(Processor &cpu, uint64_t max_steps) = 0;
+    // What the hooks saw, for the log
+    virtual std::string summary() const = 0;
+};
+
+// `spec` is "none", "count", "trace" (to stderr), "trace=path" or "watch=START-END" with
+// hexadecimal addresses. Returns nullptr with a warning for anything else.
+std::unique_ptr<HookedRunner> make_hooked_runner(const std::string &spec);
+
+#endif // __PROCESSOR_HOOKS_H__
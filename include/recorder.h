@@ -0,0 +1,66 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <cstdint>
+#include <vector>
+#include "byte_code_memory.h"
+#include "input_log.h"
+#include "processor.h"
+
+// Deterministic record/replay for one Processor. While recording, every nondeterministic
+// input goes into an InputLog and a keyframe (registers, copy-on-write memory snapshot and
+// device state) is taken every `keyframe_interval` cycles. Seeking restores the nearest
+// keyframe and re-executes forward with the inputs served from the log, so the cost of a
+// seek is bounded by the keyframe interval rather than the length of the run.
+//
+// Replayed device reads never reach the devices, so their internal state (input positions,
+// queues, status) lags behind. The live device state is saved when replay starts and put
+// back once replay catches up with the end of the recording.
+class Recorder
+{
+public:
+    Recorder(Processor &cpu, uint64_t keyframe_interval);
+    ~Recorder();
+
+    // Execute one instruction. Replays until the end of the recording, then records again.
+    bool step();
+    uint64_t run(uint64_t max_steps);
+
+    // Move to the first instruction boundary at or after `cycle`. Fails past the recording.
+    bool seek(uint64_t cycle);
+    // Move back to the start of the previous instruction
+    bool step_back();
+
+    // Host provided values (e.g. time of day) that have to be replayed identically
+    uint64_t host_value(uint64_t live);
+
+    uint64_t get_recorded_cycles() const;
+    size_t get_keyframe_count() const;
+    const InputLog &get_log() const;
+
+private:
+    struct Keyframe
+    {
+        uint64_t cycles;
+        Registers registers;
+        MemorySnapshot memory;
+        std::vector<uint8_t> device_state;
+        InputLog::Position log_position;
+    };
+
+    // Save the live device state before the first seek away from the end of the recording
+    void leave_live();
+    void take_keyframe();
+    void restore_keyframe(const Keyframe &keyframe);
+    const Keyframe &keyframe_before(uint64_t cycle) const;
+
+private:
+    Processor &cpu;
+    uint64_t keyframe_interval;
+    InputLog log;
+    std::vector<Keyframe> keyframes;
+    uint64_t recorded_until;
+    std::vector<uint8_t> live_device_state;
+};
+
+#endif // __RECORDER_H__
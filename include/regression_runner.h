@@ -0,0 +1,46 @@
+#ifndef __REGRESSION_RUNNER_H__
+#define __REGRESSION_RUNNER_H__
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Runs a directory of programs concurrently and compares them against golden files.
+//
+// Every `<name>.asm` (assembled) or `<name>.bin` (raw byte code) is loaded at 0x8000 and run
+// until BRK. If present, `<name>.out` holds the expected output stream and `<name>.regs`
+// the expected final registers as whitespace separated `A=41 X=00 Y=00 SP=FD P=00 PC=803D`
+// hex pairs. Only the registers listed are compared. A program that fails to assemble or
+// cannot be read fails without running.
+
+enum class ReportFormat
+{
+    JSON,
+    JUNIT
+};
+
+struct RegressionOptions
+{
+    std::string directory;
+    unsigned jobs = 0;              // 0 uses every core
+    uint64_t max_steps = 10000000;  // Instruction budget per program
+};
+
+struct RegressionResult
+{
+    std::string name;
+    bool passed = false;
+    std::string message;
+    uint64_t steps = 0;
+    double seconds = 0;
+};
+
+// A directory that cannot be read is reported as one failed result. `seconds`, when given,
+// receives the wall time of the whole run.
+std::vector<RegressionResult> run_regressions(const RegressionOptions &options, double *seconds = nullptr);
+
+// `seconds` is the run's wall time, each result carries its own run time
+void write_report(std::ostream &out, const std::vector<RegressionResult> &results, double seconds, ReportFormat format);
+
+#endif // __REGRESSION_RUNNER_H__
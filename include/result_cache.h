@@ -0,0 +1,83 @@
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "job_server.h"
+
+// Memoized job results for the job server. Machines start every job from the same pristine
+// state, so a job is fully determined by its image, input, load address, entry and cycle
+// budget; repeats are answered from the cache without running.
+//
+// Keys are 128 bit hashes of those, so no image or input is kept. Entries hold the response
+// header and the output, and are evicted least recently used once their total size passes
+// the budget. Jobs ending in TIMEOUT depend on the wall clock and are never stored. The
+// cache can be saved to a file and loaded on the next start. Keys and the file are tied to a
+// hash of the library sources, so a file written by another build loads as empty.
+
+static constexpr uint32_t RESULT_CACHE_VERSION = 2;
+
+struct ResultKey
+{
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const ResultKey &other) const { return low == other.low && high == other.high; }
+};
+
+class ResultCache
+{
+public:
+    // `capacity` bounds the bytes held by entries
+    ResultCache(size_t capacity);
+
+    static ResultKey key(const JobRequestHeader &request, const uint8_t *image, const uint8_t *input);
+
+    // Fill `response` (but its job id) and `output` on a hit
+    bool lookup(const ResultKey &key, JobResponseHeader &response, std::string &output);
+    void insert(const ResultKey &key, const JobResponseHeader &response, const std::string &output);
+
+    // Entries are written least recently used first, so loading keeps their order. A missing
+    // file loads as empty.
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    uint64_t get_hits() const;
+    uint64_t get_misses() const;
+    uint64_t get_evictions() const;
+    size_t get_size() const;
+
+private:
+    struct KeyHash
+    {
+        size_t operator()(const ResultKey &key) const { return key.low; }
+    };
+
+    struct Entry
+    {
+        ResultKey key;
+        JobResponseHeader response;
+        std::string output;
+    };
+
+    void insert_locked(const ResultKey &key, const JobResponseHeader &response, const std::string &output);
+    static size_t footprint(const Entry &entry);
+
+private:
+    size_t capacity;
+    size_t size;
+
+    mutable std::mutex mutex;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<ResultKey, std::list<Entry>::iterator, KeyHash> index;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+#endif // __RESULT_CACHE_H__
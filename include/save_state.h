@@ -0,0 +1,36 @@
+#ifndef __SAVE_STATE_H__
+#define __SAVE_STATE_H__
+
+#include <cstdint>
+#include <string>
+#include "processor.h"
+
+// A save state file is a sequence of segments, each holding the registers, cycle count,
+// device state and a set of memory pages. Later segments only carry the pages written since
+// the previous one, and the latest copy of a page wins when loading.
+//
+// The version changes with the segment layout or the layout of any device's state.
+
+static constexpr uint32_t SAVE_STATE_VERSION = 1;
+
+class SaveStateWriter
+{
+public:
+    // With `append` an existing file is extended. Otherwise the file is replaced atomically
+    // on the first save, so machines still mapping the old file are unaffected.
+    SaveStateWriter(const std::string &path, bool append);
+
+    // The first save of a new file writes every non zero page, later saves only the pages
+    // written since the previous save.
+    bool save(Processor &cpu);
+
+private:
+    std::string path;
+    bool append;
+};
+
+// Resume `cpu` from the latest segment in `path`. The file is mapped read-only and memory
+// pages point straight into the mapping, being copied on their first write.
+bool load_save_state(const std::string &path, Processor &cpu);
+
+#endif // __SAVE_STATE_H__
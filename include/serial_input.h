@@ -0,0 +1,79 @@
+#ifndef __SERIAL_INPUT_H__
+#define __SERIAL_INPUT_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "device.h"
+#include "spsc_queue.h"
+
+// Keyboard/serial input fed from host files, pipes or stdin.
+//
+// A reactor thread waits on the sources with epoll (regular files, which epoll cannot
+// watch, are simply read while there is room) and moves the bytes into a lock-free queue.
+// The CPU only ever pops from the queue and never waits on host I/O. When the queue is
+// full the reactor stops reading until the program drained some of it, so scripted input
+// of any size flows at the program's pace without being dropped.
+//
+// Registers, relative to the mapped base:
+//   0 data: pops the next byte, 0 when none is queued
+//   1 status: bit 0 a byte is queued, bit 7 every source reached its end and the queue is empty
+//   2 queued bytes, clamped to 255
+//   3 control: bit 0 raises SERIAL_IRQ while bytes are queued
+class SerialInputDevice : public Device
+{
+public:
+    SerialInputDevice(size_t queue_capacity = 1 << 20);
+    ~SerialInputDevice();
+
+    // Read `path`, "-" for stdin. FIFOs are kept open, so writers may come and go.
+    bool open(const std::string &path);
+    // Start the reactor once every source is open
+    void start();
+    // Stop the reactor and give stdin back its original flags
+    void stop();
+
+    void connect(ByteCodeMemory *bus) override;
+    const char *get_name() const override { return "serial"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+
+    // Only the control register is saved, queued input belongs to the host
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+    uint64_t get_received() const;
+
+private:
+    struct Source
+    {
+        int fd;
+        bool pollable; // Registered with epoll, regular files are not
+    };
+
+    void run();
+    // Returns false once `source` reached its end
+    bool drain(Source &source);
+    void update_irq();
+
+private:
+    ByteCodeMemory *bus = nullptr;
+    SpscQueue<uint8_t> queue;
+    std::vector<Source> sources;
+    int epoll_fd;
+    int wake_fd; // Wakes the reactor for room in the queue or to stop
+    int stdin_flags = -1; // Before O_NONBLOCK was set, stdin's file description is shared
+
+    std::thread reactor;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> finished{false};      // All sources reached their end
+    std::atomic<bool> waiting_for_room{false};
+    std::atomic<bool> irq_enabled{false};
+    std::atomic<uint64_t> received{0};
+    uint8_t control = 0;
+};
+
+#endif // __SERIAL_INPUT_H__
@@ -0,0 +1,93 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Each side caches the other's position and only reloads it when the queue looks full or
+// empty, so the shared cache lines are touched once per batch rather than per item.
+template <typename T>
+class SpscQueue
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        buffer.resize(size);
+        mask = size - 1;
+    }
+
+    // Producer: append up to `count` items, returns how many fit
+    size_t push(const T *items, size_t count)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        if (buffer.size() - (position - cached_head) < count)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+        }
+        count = std::min(count, buffer.size() - (position - cached_head));
+
+        for (size_t i = 0; i < count; i++)
+        {
+            buffer[(position + i) & mask] = items[i];
+        }
+        tail.store(position + count, std::memory_order_release);
+        return count;
+    }
+
+    // Producer: room left, at least this many items can be pushed
+    size_t free_space()
+    {
+        cached_head = head.load(std::memory_order_acquire);
+        return buffer.size() - (tail.load(std::memory_order_relaxed) - cached_head);
+    }
+
+    // Consumer
+    bool pop(T &item)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (position == cached_tail)
+            {
+                return false;
+            }
+        }
+        item = buffer[position & mask];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: items ready to pop
+    size_t size()
+    {
+        cached_tail = tail.load(std::memory_order_acquire);
+        return cached_tail - head.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return buffer.size();
+    }
+
+private:
+    std::vector<T> buffer;
+    size_t mask;
+
+    // Positions only grow, indices are taken modulo the capacity
+    alignas(64) std::atomic<size_t> head{0}; // Next item to pop
+    size_t cached_tail = 0;                  // Consumer's copy of tail
+    alignas(64) std::atomic<size_t> tail{0}; // Next free slot
+    size_t cached_head = 0;                  // Producer's copy of head
+};
+
+#endif // __SPSC_QUEUE_H__
@@ -0,0 +1,107 @@
+#ifndef __STATE_EXPORT_H__
+#define __STATE_EXPORT_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Live CPU state published to a POSIX shared memory segment for monitoring tools.
+//
+// The emulation thread is the only writer and never waits: it bumps the sequence to an odd
+// value, stores the fields and bumps it to even again (a seqlock). Readers copy the fields
+// and retry if the sequence was odd or changed meanwhile, so they never block the writer.
+
+static constexpr uint32_t STATE_EXPORT_VERSION = 3;
+static constexpr uint32_t EXPORTED_DEVICE_COUNT = 8;
+// Device names are exported NUL padded in this many 8 byte words, longer names are cut
+static constexpr uint32_t EXPORTED_NAME_WORDS = 2;
+static constexpr char STATE_EXPORT_MAGIC[4] = {'E', '6', '5', 'X'};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "exported state needs address free atomics");
+
+// Layout of the shared segment. Fields are atomics so the racy reads are well defined,
+// all accesses besides `sequence` are relaxed.
+struct ExportedStateSegment
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t pid;
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> instructions;
+    std::atomic<uint64_t> instructions_per_second;
+    std::atomic<uint64_t> registers; // PC << 40 | SP << 32 | status << 24 | Y << 16 | X << 8 | A
+    std::atomic<uint64_t> updated_ns; // CLOCK_REALTIME of the last publish
+    std::atomic<uint64_t> device_count;
+    std::atomic<uint64_t> device_accesses[EXPORTED_DEVICE_COUNT];
+    std::atomic<uint64_t> interrupts;
+    std::atomic<uint64_t> input_log_bytes; // Size of the record/replay log, 0 without one
+    std::atomic<uint64_t> device_names[EXPORTED_DEVICE_COUNT][EXPORTED_NAME_WORDS];
+};
+
+// One consistent copy of the segment
+struct ExportedState
+{
+    uint32_t pid = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t instructions_per_second = 0;
+    uint16_t PC = 0;
+    uint8_t A = 0;
+    uint8_t X = 0;
+    uint8_t Y = 0;
+    uint8_t status = 0;
+    uint8_t SP = 0;
+    uint64_t updated_ns = 0;
+    uint64_t device_count = 0;
+    uint64_t device_accesses[EXPORTED_DEVICE_COUNT] = {};
+    uint64_t interrupts = 0;
+    uint64_t input_log_bytes = 0;
+    char device_names[EXPORTED_DEVICE_COUNT][EXPORTED_NAME_WORDS * 8 + 1] = {};
+};
+
+class Processor;
+
+class StateExporter
+{
+public:
+    // Create the segment `name`, "/emu6502-<pid>" when empty. It is unlinked on destruction.
+    // Unless `shared`, the segment is private memory only read in process, e.g. by StatsReporter.
+    StateExporter(const std::string &name = "", bool shared = true);
+    ~StateExporter();
+    StateExporter(const StateExporter &) = delete;
+
+    bool is_open() const;
+    const std::string &get_name() const;
+
+    // Called by the processor every export interval
+    void publish(Processor &cpu);
+    // The latest published state, from any thread
+    bool read(ExportedState &state) const;
+
+private:
+    std::string name;
+    bool shared;
+    ExportedStateSegment *segment;
+    uint64_t last_instructions;
+    uint64_t last_ns;
+};
+
+class StateReader
+{
+public:
+    StateReader(const std::string &name);
+    ~StateReader();
+    StateReader(const StateReader &) = delete;
+
+    bool is_open() const;
+
+    // Copy the latest published state. Returns false if the writer was mid update on every
+    // attempt, which only happens when it publishes far more often than it should.
+    bool read(ExportedState &state) const;
+
+private:
+    const ExportedStateSegment *segment;
+};
+
+#endif // __STATE_EXPORT_H__
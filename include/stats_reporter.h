@@ -0,0 +1,50 @@
+#ifndef __STATS_REPORTER_H__
+#define __STATS_REPORTER_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "state_export.h"
+
+// Periodic throughput report from a background thread, in the Prometheus text format.
+//
+// The reporter never touches the processor: it samples what the processor publishes to
+// `source` every export interval, so the CPU thread only pays for the relaxed stores of
+// StateExporter::publish. Rates are computed between consecutive samples.
+class StatsReporter
+{
+public:
+    // Report every `interval` to `path`, or to stderr when it is empty. Files are replaced
+    // atomically, so scrapers such as node_exporter's textfile collector see whole reports.
+    StatsReporter(const StateExporter &source, std::chrono::milliseconds interval, const std::string &path = "");
+    ~StatsReporter();
+    StatsReporter(const StatsReporter &) = delete;
+
+    void start();
+    // Write a last report and join the thread
+    void stop();
+
+private:
+    void run();
+    void report();
+
+private:
+    const StateExporter &source;
+    std::chrono::milliseconds interval;
+    std::string path;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    // Previous sample, for rates
+    bool have_previous;
+    ExportedState previous;
+    std::chrono::steady_clock::time_point previous_time;
+};
+
+#endif // __STATS_REPORTER_H__
@@ -0,0 +1,129 @@
+#ifndef __STORAGE_DEVICE_H__
+#define __STORAGE_DEVICE_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "device.h"
+
+enum class StorageCommand : uint8_t
+{
+    NONE,
+    READ,  // Sector into memory at the address register
+    WRITE, // Memory at the address register into the sector
+    FLUSH  // Write every cached sector to the image and sync it
+};
+
+// Disk controller over a host image file, transferring whole sectors to and from memory.
+//
+// Registers, relative to the mapped base, little endian:
+//   0-3 sector number
+//   4-5 memory address
+//   6   command: writing a StorageCommand starts it
+//   7   status: bit 7 busy, bit 1 done, bit 0 error
+//   8   control: bit 0 raises STORAGE_IRQ when a command completes
+//
+// A worker thread does the file I/O, so the CPU never waits on it. Reads are served from a
+// sector cache the worker fills ahead of sequential reads, writes complete once they are in
+// the cache and reach the file in the background (write-back). A read that misses the
+// cache stays busy until the worker has it; its data lands in memory when the program sees
+// the status change, by reading the status register. Reading the status also acknowledges
+// the interrupt.
+//
+// Under record/replay, whether a read hit the cache, when a busy command was seen to finish
+// and the sector data put in memory are logged as input. Replays take them from the log and
+// leave the cache, the worker and the image alone.
+class StorageDevice : public Device
+{
+public:
+    // `sector_size` is 256 or 512. `read_ahead` sectors after each read are prefetched.
+    StorageDevice(uint32_t sector_size = 256, uint32_t read_ahead = 16, size_t cache_sectors = 4096);
+    // Writes back every dirty sector
+    ~StorageDevice();
+
+    // Open or create the image
+    bool open(const std::string &path);
+
+    void connect(ByteCodeMemory *bus) override;
+    const char *get_name() const override { return "storage"; }
+    void write(uint16_t address, uint8_t value) override;
+    uint8_t read(uint16_t address) override;
+    void replay_read(uint16_t address) override;
+
+    // Registers only, the image belongs to the host. An interrupted read is restarted.
+    void save_state(std::vector<uint8_t> &out) const override;
+    bool load_state(const uint8_t *data, size_t size) override;
+
+    uint64_t get_cache_hits() const;
+    uint64_t get_cache_misses() const;
+
+private:
+    struct Sector
+    {
+        std::vector<uint8_t> data;
+        bool dirty;
+        std::list<uint32_t>::iterator lru; // Position in `recent`
+    };
+
+    enum class Pending : uint8_t
+    {
+        NONE,
+        READ,      // Queued for the worker
+        FLUSH,
+        COMPLETED, // Worker finished, waiting for the program to look
+        FAILED
+    };
+
+    void start(StorageCommand command);
+    // Finish a command the worker completed, on the CPU thread. Returns the status.
+    uint8_t poll();
+    void complete(bool error);
+    // Copy a sector into memory, through the input log when there is one
+    void transfer_in(uint16_t address, std::vector<uint8_t> &data);
+    bool is_replaying() const;
+
+    void work();
+    // With the lock held
+    Sector *lookup(uint32_t sector);
+    void insert(uint32_t sector, std::vector<uint8_t> data, bool dirty);
+    bool load(uint32_t sector, std::vector<uint8_t> &data);
+    void queue_prefetch(uint32_t sector);
+    // Write dirty sectors, one or all of them, dropping the lock around the I/O
+    bool write_back(std::unique_lock<std::mutex> &lock, bool all);
+
+private:
+    ByteCodeMemory *bus = nullptr;
+    uint32_t sector_size;
+    uint32_t read_ahead;
+    size_t cache_sectors;
+    int fd;
+
+    uint8_t registers[9] = {};
+    uint32_t transfer_sector = 0;
+    uint16_t transfer_address = 0;
+    std::vector<uint8_t> transfer_data;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::unordered_map<uint32_t, Sector> cache;
+    std::list<uint32_t> recent; // Most recently used first
+    std::vector<uint32_t> prefetch;
+    std::atomic<Pending> pending{Pending::NONE};
+    StorageCommand pending_command = StorageCommand::NONE;
+    std::atomic<bool> irq_enabled{false};
+    size_t dirty_count = 0;
+    bool stopping = false;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    std::thread worker;
+};
+
+#endif // __STORAGE_DEVICE_H__
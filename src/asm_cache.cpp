@@ -0,0 +1,349 @@
+#include "asm_cache.h"
+#include "assembler.h"
+#include "build_id.h"
+#include "logging.h"
+#include "mapped_file.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct ImageHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t image_size;
+    uint32_t symbol_count;
+    uint32_t symbols_size;
+    uint16_t origin;
+    uint16_t reserved;
+};
+
+static constexpr char IMAGE_MAGIC[4] = {'E', '6', '5', 'A'};
+
+// A file the image was built from, as seen when the manifest was written
+struct Dependency
+{
+    uint64_t size;
+    uint64_t mtime_ns;
+    std::string path;
+};
+
+// The symbol table follows the header, byte code starts at the next PAGE_SIZE boundary
+static size_t align_to_page(size_t offset)
+{
+    return (offset + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+// FNV-1a, as used by PageCache
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Starts every key and manifest name, so a build from other sources never reuses entries
+static uint64_t build_hash()
+{
+    return hash_bytes(0xCBF29CE484222325ULL, &EMU6502_BUILD_ID, sizeof(EMU6502_BUILD_ID));
+}
+
+static std::string hex(uint64_t value)
+{
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+    return text;
+}
+
+static bool stat_dependency(const std::string &path, Dependency &dependency)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        return false;
+    }
+    dependency.size = info.st_size;
+    dependency.mtime_ns = uint64_t(info.st_mtim.tv_sec) * 1000000000ULL + info.st_mtim.tv_nsec;
+    dependency.path = path;
+    return true;
+}
+
+// Key of the image built from `sources` at `origin` by this build. Only contents are hashed,
+// so copies of a program share one image.
+static bool hash_sources(const std::vector<std::string> &sources, uint16_t origin, uint64_t &key)
+{
+    key = build_hash();
+    key = hash_bytes(key, &ASM_CACHE_VERSION, sizeof(ASM_CACHE_VERSION));
+    key = hash_bytes(key, &origin, sizeof(origin));
+
+    for (const std::string &source : sources)
+    {
+        std::ifstream file(source, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        uint64_t length = contents.size();
+        key = hash_bytes(key, &length, sizeof(length));
+        key = hash_bytes(key, contents.data(), contents.size());
+    }
+    return true;
+}
+
+static std::string manifest_line(const Dependency &dependency)
+{
+    return "file " + std::to_string(dependency.size) + " " + std::to_string(dependency.mtime_ns) + " " + dependency.path + "\n";
+}
+
+static bool read_manifest(const std::string &path, uint64_t &key, std::vector<Dependency> &dependencies)
+{
+    std::ifstream file(path);
+    std::string word;
+    if (!(file >> word >> std::hex >> key >> std::dec) || word != "key")
+    {
+        return false;
+    }
+
+    Dependency dependency;
+    while (file >> word >> dependency.size >> dependency.mtime_ns && word == "file")
+    {
+        file >> std::ws;
+        getline(file, dependency.path);
+        dependencies.push_back(dependency);
+    }
+    return !dependencies.empty();
+}
+
+// Write `contents` to a private temporary file and rename it over `path`
+static bool write_atomically(const std::string &path, const std::string &contents)
+{
+    static std::atomic<uint32_t> counter{0};
+    std::string temporary = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(counter++);
+
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+    file.close();
+    if (!file || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+static std::string serialize_image(uint64_t key, uint16_t origin, const Assembly &assembly)
+{
+    std::string symbols;
+    for (const auto &symbol : assembly.symbols)
+    {
+        uint16_t value = symbol.second;
+        uint16_t length = symbol.first.size();
+        symbols.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        symbols.append(reinterpret_cast<const char *>(&length), sizeof(length));
+        symbols.append(symbol.first);
+    }
+
+    ImageHeader header = {};
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = ASM_CACHE_VERSION;
+    header.key = key;
+    header.image_size = assembly.byte_code.size();
+    header.symbol_count = assembly.symbols.size();
+    header.symbols_size = symbols.size();
+    header.origin = origin;
+
+    // Byte code is padded to whole pages so every page can be mapped from the file
+    std::string image(reinterpret_cast<const char *>(&header), sizeof(header));
+    image += symbols;
+    image.resize(align_to_page(image.size()), '\0');
+    image.append(assembly.byte_code.begin(), assembly.byte_code.end());
+    image.resize(align_to_page(image.size()), '\0');
+    return image;
+}
+
+static bool map_image(const std::string &path, uint64_t key, uint16_t origin, ByteCodeMemory &memory,
+                      std::map<std::string, uint16_t> *symbols, size_t *size)
+{
+    std::shared_ptr<MappedFile> file = MappedFile::open(path);
+    if (!file || file->size() < sizeof(ImageHeader))
+    {
+        return false;
+    }
+
+    const ImageHeader *header = reinterpret_cast<const ImageHeader *>(file->data());
+    size_t data_offset = align_to_page(sizeof(ImageHeader) + header->symbols_size);
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != ASM_CACHE_VERSION ||
+        header->key != key || header->origin != origin || uint32_t(origin) + header->image_size > MEMORY_SIZE ||
+        data_offset + align_to_page(header->image_size) > file->size())
+    {
+        LOG_WARN("Ignoring malformed assembly cache entry " + path);
+        return false;
+    }
+
+    if (symbols)
+    {
+        const uint8_t *cursor = file->data() + sizeof(ImageHeader);
+        const uint8_t *end = cursor + header->symbols_size;
+        for (uint32_t i = 0; i < header->symbol_count && cursor + 4 <= end; i++)
+        {
+            uint16_t value, length;
+            memcpy(&value, cursor, sizeof(value));
+            memcpy(&length, cursor + 2, sizeof(length));
+            cursor += 4;
+            if (cursor + length > end)
+            {
+                break;
+            }
+            (*symbols)[std::string(reinterpret_cast<const char *>(cursor), length)] = value;
+            cursor += length;
+        }
+    }
+
+    // Pages the image fully covers are mapped from the file. A partial tail is overlaid like
+    // on a miss, keeping whatever follows the image in its page.
+    size_t mapped = origin % PAGE_SIZE == 0 ? header->image_size / PAGE_SIZE * PAGE_SIZE : 0;
+    for (size_t offset = 0; offset < mapped; offset += PAGE_SIZE)
+    {
+        memory.map_page((origin + offset) / PAGE_SIZE, MappedFile::page(file, data_offset + offset));
+    }
+    if (mapped < header->image_size)
+    {
+        memory.load_shared(origin + mapped, file->data() + data_offset + mapped, header->image_size - mapped);
+    }
+
+    if (size)
+    {
+        *size = header->image_size;
+    }
+    return true;
+}
+
+AssemblyCache::AssemblyCache(const std::string &directory) : directory(directory), hits(0), misses(0) {}
+
+std::string AssemblyCache::default_directory()
+{
+    if (const char *path = getenv("EMU6502_ASM_CACHE"))
+    {
+        return path;
+    }
+    if (const char *path = getenv("XDG_CACHE_HOME"))
+    {
+        return std::string(path) + "/emu6502";
+    }
+    const char *home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/emu6502";
+}
+
+bool AssemblyCache::load(const std::string &filename, uint16_t origin, ByteCodeMemory &memory,
+                         std::map<std::string, uint16_t> *symbols, size_t *size)
+{
+    std::error_code error;
+    fs::path source = fs::absolute(filename, error).lexically_normal();
+    std::string manifest = directory + "/" + hex(hash_bytes(build_hash(), source.c_str(), source.native().size())) + ".dep";
+
+    uint64_t key;
+    std::vector<Dependency> dependencies;
+    if (read_manifest(manifest, key, dependencies))
+    {
+        bool unchanged = true;
+        for (Dependency &dependency : dependencies)
+        {
+            Dependency current;
+            if (!stat_dependency(dependency.path, current) || current.size != dependency.size ||
+                current.mtime_ns != dependency.mtime_ns)
+            {
+                unchanged = false;
+            }
+            dependency = current;
+        }
+
+        // Touched but identical files still hash to an existing image
+        std::vector<std::string> sources;
+        for (const Dependency &dependency : dependencies)
+        {
+            sources.push_back(dependency.path);
+        }
+        if (!unchanged && !hash_sources(sources, origin, key))
+        {
+            key = 0;
+        }
+
+        if (key && map_image(directory + "/" + hex(key) + ".img", key, origin, memory, symbols, size))
+        {
+            if (!unchanged)
+            {
+                std::string contents = "key " + hex(key) + "\n";
+                for (const Dependency &dependency : dependencies)
+                {
+                    contents += manifest_line(dependency);
+                }
+                write_atomically(manifest, contents);
+            }
+            hits++;
+            return true;
+        }
+    }
+
+    misses++;
+    LOG_DEBUG("Assembly cache miss for " + source.string());
+
+    Assembly assembly;
+    if (!assemble(source.string(), origin, assembly))
+    {
+        return false;
+    }
+
+    // Stat before hashing, so a file changing meanwhile fails the next manifest check
+    std::string contents;
+    bool cacheable = true;
+    for (const std::string &path : assembly.sources)
+    {
+        Dependency dependency;
+        cacheable = cacheable && stat_dependency(fs::path(path).lexically_normal().string(), dependency);
+        contents += manifest_line(dependency);
+    }
+    cacheable = cacheable && hash_sources(assembly.sources, origin, key);
+
+    fs::create_directories(directory, error);
+    if (!cacheable || !write_atomically(directory + "/" + hex(key) + ".img", serialize_image(key, origin, assembly)) ||
+        !write_atomically(manifest, "key " + hex(key) + "\n" + contents))
+    {
+        LOG_WARN("Could not store " + source.string() + " in the assembly cache " + directory);
+    }
+
+    memory.load_shared(origin, assembly.byte_code.data(), assembly.byte_code.size());
+    if (symbols)
+    {
+        *symbols = assembly.symbols;
+    }
+    if (size)
+    {
+        *size = assembly.byte_code.size();
+    }
+    return true;
+}
+
+uint64_t AssemblyCache::get_hits() const
+{
+    return hits;
+}
+
+uint64_t AssemblyCache::get_misses() const
+{
+    return misses;
+}
@@ -0,0 +1,198 @@
+#include "logging.h"
+#include "processor.h"
+#include "assembler.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <map>
+
+const std::map<std::string, OpCode> OPCODE_MAP = {
+    {"LDA", OpCode::LDA_IMM},
+    {"STA", OpCode::STA_ABS},
+    {"BRK", OpCode::BRK}};
+
+// Absolute operand naming a label, patched once every file was read
+struct Fixup
+{
+    size_t offset;
+    std::string label;
+    std::string filename;
+    int lineNumber;
+};
+
+// Includes nested deeper than this are assumed to be recursive
+static constexpr int MAX_INCLUDE_DEPTH = 16;
+
+// Hex digits with an optional 0x prefix, as the operand stream accepted before labels
+static bool is_hex(const std::string &text)
+{
+    size_t digits = text.compare(0, 2, "0x") == 0 || text.compare(0, 2, "0X") == 0 ? 2 : 0;
+    return text.size() > digits && text.find_first_not_of("0123456789abcdefABCDEF", digits) == std::string::npos;
+}
+
+static bool assemble_file(const std::string &filename, uint16_t origin, Assembly &assembly, std::vector<Fixup> &fixups, int depth)
+{
+    std::ifstream file(filename);
+    if (!file)
+    {
+        LOG_WARN("Could not open " + filename);
+        return false;
+    }
+    assembly.sources.push_back(filename);
+
+    std::vector<uint8_t> &byte_code = assembly.byte_code;
+    std::string line;
+    int lineNumber = 0;
+    bool ok = true;
+
+    while (getline(file, line))
+    {
+        lineNumber++;
+
+        LOG_DEBUG("Processing line " + std::to_string(lineNumber) + ": " + line);
+
+        line = line.substr(0, line.find(';'));
+        std::istringstream iss(line);
+        std::string instruction;
+        iss >> instruction;
+
+        if (instruction.size() > 1 && instruction.back() == ':')
+        {
+            std::string label = instruction.substr(0, instruction.size() - 1);
+            assembly.symbols[label] = static_cast<uint16_t>(origin + byte_code.size());
+            LOG_DEBUG("  Defined label " + label);
+
+            instruction.clear();
+            iss >> instruction;
+        }
+
+        if (instruction.empty())
+        {
+            continue;
+        }
+
+        if (instruction == ".include")
+        {
+            std::string path;
+            iss >> std::ws;
+            getline(iss, path);
+            while (!path.empty() && (path.back() == '"' || isspace(static_cast<unsigned char>(path.back()))))
+            {
+                path.pop_back();
+            }
+            if (!path.empty() && path.front() == '"')
+            {
+                path.erase(0, 1);
+            }
+
+            std::filesystem::path included = std::filesystem::path(filename).parent_path() / path;
+            if (depth >= MAX_INCLUDE_DEPTH)
+            {
+                LOG_WARN("  Includes nested too deep at " + included.string());
+                return false;
+            }
+            ok = assemble_file(included.string(), origin, assembly, fixups, depth + 1) && ok;
+            continue;
+        }
+
+        if (OPCODE_MAP.find(instruction) != OPCODE_MAP.end())
+        {
+            OpCode op_code = OPCODE_MAP.at(instruction);
+            byte_code.push_back(static_cast<uint8_t>(op_code));
+
+            LOG_DEBUG("  Matched instruction: " + instruction + " to opcode: " + std::to_string(static_cast<int>(op_code)));
+
+            switch (op_code)
+            {
+            case OpCode::LDA_IMM:
+            {
+                uint16_t value;
+                iss >> std::hex >> value;
+                byte_code.push_back(static_cast<uint8_t>(value));
+
+                LOG_DEBUG("    Loaded immediate value: " + std::to_string((int)value));
+            }
+            break;
+
+            case OpCode::STA_ABS:
+            {
+                std::string operand;
+                iss >> operand;
+
+                // A valid hex literal is an address, anything else names a label
+                uint16_t address = 0;
+                if (!operand.empty() && !is_hex(operand))
+                {
+                    fixups.push_back({byte_code.size(), operand, filename, lineNumber});
+                }
+                else if (!operand.empty())
+                {
+                    unsigned long value = MEMORY_SIZE;
+                    try
+                    {
+                        value = std::stoul(operand, nullptr, 16);
+                    }
+                    catch (const std::out_of_range &)
+                    {
+                    }
+                    if (value >= MEMORY_SIZE)
+                    {
+                        LOG_WARN("  Address " + operand + " out of range at " + filename + ":" + std::to_string(lineNumber));
+                        ok = false;
+                    }
+                    else
+                    {
+                        address = static_cast<uint16_t>(value);
+                    }
+                }
+                byte_code.push_back(static_cast<uint8_t>(address & 0xFF));
+                byte_code.push_back(static_cast<uint8_t>((address >> 8) & 0xFF));
+
+                LOG_DEBUG("    Stored value to absolute address: " + operand);
+            }
+            break;
+
+            default:
+                LOG_DEBUG("    Instruction doesn't require additional bytes.");
+                break;
+            }
+        }
+        else
+        {
+            LOG_WARN("  Instruction " + instruction + " not found in opcode map.");
+        }
+
+        LOG_DEBUG("");
+    }
+
+    return ok;
+}
+
+bool assemble(const std::string &filename, uint16_t origin, Assembly &assembly)
+{
+    std::vector<Fixup> fixups;
+    bool ok = assemble_file(filename, origin, assembly, fixups, 0);
+
+    for (const Fixup &fixup : fixups)
+    {
+        auto symbol = assembly.symbols.find(fixup.label);
+        if (symbol == assembly.symbols.end())
+        {
+            LOG_WARN("Undefined label " + fixup.label + " at " + fixup.filename + ":" + std::to_string(fixup.lineNumber));
+            ok = false;
+            continue;
+        }
+        assembly.byte_code[fixup.offset] = static_cast<uint8_t>(symbol->second & 0xFF);
+        assembly.byte_code[fixup.offset + 1] = static_cast<uint8_t>((symbol->second >> 8) & 0xFF);
+    }
+
+    return ok;
+}
+
+std::vector<uint8_t> interpret(const std::string &filename)
+{
+    Assembly assembly;
+    assemble(filename, PROGRAM_ORIGIN, assembly);
+    return assembly.byte_code;
+}
@@ -0,0 +1,185 @@
+#include "bank_controller.h"
+#include <algorithm>
+#include <cstring>
+
+// Offset of the high byte registers
+static constexpr uint16_t BANK_HIGH_REGISTERS = 0x10;
+
+BankController::BankController(uint32_t window_size, uint32_t bank_count, const std::vector<BankWindow> &windows)
+    : pages_per_window(std::max<uint32_t>(window_size / PAGE_SIZE, 1)), bank_count(std::max<uint32_t>(bank_count, 1)),
+      windows(windows), store(size_t(this->bank_count) * pages_per_window), selected(windows.size(), 0),
+      high_latch(windows.size(), 0)
+{
+    memset(store.data(), 0, store.size() * sizeof(MemoryPage));
+}
+
+void BankController::load(size_t offset, const uint8_t *bytes, size_t size)
+{
+    size_t capacity = store.size() * PAGE_SIZE;
+    if (offset >= capacity)
+    {
+        return;
+    }
+    size = std::min(size, capacity - offset);
+    memcpy(reinterpret_cast<uint8_t *>(store.data()) + offset, bytes, size);
+
+    // Host contents of banks already mapped writable
+    size_t bank_size = size_t(pages_per_window) * PAGE_SIZE;
+    for (auto &bank : pristine)
+    {
+        size_t start = std::max(offset, bank.first * bank_size);
+        size_t end = std::min(offset + size, (bank.first + 1) * bank_size);
+        if (start < end)
+        {
+            memcpy(reinterpret_cast<uint8_t *>(bank.second.data()) + start - bank.first * bank_size, bytes + start - offset, end - start);
+        }
+    }
+}
+
+void BankController::connect(ByteCodeMemory *memory)
+{
+    bus = memory;
+    for (uint32_t window = 0; window < windows.size(); window++)
+    {
+        select(window, selected[window]);
+    }
+}
+
+void BankController::write(uint16_t address, uint8_t value)
+{
+    uint32_t reg = address & 0xFF;
+    if (reg < windows.size())
+    {
+        select(reg, uint32_t(high_latch[reg]) << 8 | value);
+    }
+    else if (reg >= BANK_HIGH_REGISTERS && reg - BANK_HIGH_REGISTERS < windows.size())
+    {
+        high_latch[reg - BANK_HIGH_REGISTERS] = value;
+    }
+}
+
+uint8_t BankController::read(uint16_t address)
+{
+    uint32_t reg = address & 0xFF;
+    if (reg < windows.size())
+    {
+        return selected[reg] & 0xFF;
+    }
+    if (reg >= BANK_HIGH_REGISTERS && reg - BANK_HIGH_REGISTERS < windows.size())
+    {
+        return selected[reg - BANK_HIGH_REGISTERS] >> 8;
+    }
+    return 0;
+}
+
+void BankController::select(uint32_t window, uint32_t bank)
+{
+    bank %= bank_count;
+    selected[window] = bank;
+    switches++;
+
+    // The bank's contents become part of the machine state from its first writable mapping
+    MemoryPage *pages = &store[size_t(bank) * pages_per_window];
+    if (windows[window].writable && !pristine.count(bank))
+    {
+        pristine[bank].assign(pages, pages + pages_per_window);
+    }
+    if (!bus)
+    {
+        return;
+    }
+
+    // Nothing is copied, the window's page table entries point into the store
+    uint32_t first_page = windows[window].start / PAGE_SIZE;
+    for (uint32_t page = 0; page < pages_per_window && first_page + page < PAGE_COUNT; page++)
+    {
+        bus->map_external(first_page + page, pages[page].bytes, windows[window].writable);
+    }
+}
+
+uint32_t BankController::get_bank(uint32_t window) const
+{
+    return selected[window];
+}
+
+uint64_t BankController::get_switches() const
+{
+    return switches;
+}
+
+void BankController::save_state(std::vector<uint8_t> &out) const
+{
+    for (uint32_t window = 0; window < windows.size(); window++)
+    {
+        uint32_t bank = selected[window];
+        out.insert(out.end(), reinterpret_cast<const uint8_t *>(&bank), reinterpret_cast<const uint8_t *>(&bank + 1));
+        out.push_back(high_latch[window]);
+    }
+
+    uint32_t count = pristine.size();
+    out.insert(out.end(), reinterpret_cast<const uint8_t *>(&count), reinterpret_cast<const uint8_t *>(&count + 1));
+    for (const auto &bank : pristine)
+    {
+        const uint8_t *contents = store[size_t(bank.first) * pages_per_window].bytes;
+        out.insert(out.end(), reinterpret_cast<const uint8_t *>(&bank.first), reinterpret_cast<const uint8_t *>(&bank.first + 1));
+        out.insert(out.end(), contents, contents + size_t(pages_per_window) * PAGE_SIZE);
+    }
+}
+
+bool BankController::load_state(const uint8_t *data, size_t size)
+{
+    size_t bank_size = size_t(pages_per_window) * PAGE_SIZE;
+    size_t windows_size = windows.size() * (sizeof(uint32_t) + 1);
+    uint32_t count;
+    if (size < windows_size + sizeof(count))
+    {
+        return false;
+    }
+    memcpy(&count, data + windows_size, sizeof(count));
+    const uint8_t *banks = data + windows_size + sizeof(count);
+    if (size != windows_size + sizeof(count) + size_t(count) * (sizeof(uint32_t) + bank_size))
+    {
+        return false;
+    }
+
+    // Banks written since the state was saved go back to what the host loaded
+    std::vector<bool> saved(bank_count, false);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t bank;
+        memcpy(&bank, banks + i * (sizeof(uint32_t) + bank_size), sizeof(bank));
+        if (bank >= bank_count)
+        {
+            return false;
+        }
+        saved[bank] = true;
+    }
+    for (const auto &bank : pristine)
+    {
+        if (!saved[bank.first])
+        {
+            memcpy(store[size_t(bank.first) * pages_per_window].bytes, bank.second.data(), bank_size);
+        }
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *entry = banks + i * (sizeof(uint32_t) + bank_size);
+        uint32_t bank;
+        memcpy(&bank, entry, sizeof(bank));
+        MemoryPage *pages = &store[size_t(bank) * pages_per_window];
+        if (!pristine.count(bank))
+        {
+            pristine[bank].assign(pages, pages + pages_per_window);
+        }
+        memcpy(pages->bytes, entry + sizeof(bank), bank_size);
+    }
+
+    for (uint32_t window = 0; window < windows.size(); window++)
+    {
+        uint32_t bank;
+        memcpy(&bank, data + window * (sizeof(uint32_t) + 1), sizeof(bank));
+        high_latch[window] = data[window * (sizeof(uint32_t) + 1) + sizeof(uint32_t)];
+        select(window, bank);
+    }
+    return true;
+}
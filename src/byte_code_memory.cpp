@@ -1,31 +1,510 @@
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include "byte_code_memory.h"
 #include "logging.h"
+#include "mapped_file.h"
+
+PageCache &PageCache::global()
+{
+    // Never destroyed, pages held by other statics release into it at exit
+    static PageCache *cache = new PageCache();
+    return *cache;
+}
+
+const std::shared_ptr<MemoryPage> &PageCache::zero_page()
+{
+    static const std::shared_ptr<MemoryPage> page = std::make_shared<MemoryPage>();
+    return page;
+}
+
+std::shared_ptr<MemoryPage> PageCache::intern(const uint8_t *bytes)
+{
+    // FNV-1a over the page contents
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    bool zero = true;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+        zero &= bytes[i] == 0;
+    }
+
+    if (zero)
+    {
+        return zero_page();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto range = pages.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        // A page whose last user is gone but not yet released is skipped
+        std::shared_ptr<MemoryPage> page = it->second.shared.lock();
+        if (page && memcmp(page->bytes, bytes, PAGE_SIZE) == 0)
+        {
+            return page;
+        }
+    }
+
+    // The deleter drops the entry along with the page
+    MemoryPage *data = new MemoryPage();
+    memcpy(data->bytes, bytes, PAGE_SIZE);
+    std::shared_ptr<MemoryPage> page(data, [this, hash](MemoryPage *page)
+                                     { release(hash, page); });
+    pages.emplace(hash, Entry{data, page});
+    return page;
+}
+
+void PageCache::release(uint64_t hash, MemoryPage *page)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = pages.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second.page == page)
+            {
+                pages.erase(it);
+                break;
+            }
+        }
+    }
+    delete page;
+}
+
+size_t PageCache::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pages.size();
+}
 
 ByteCodeMemory::ByteCodeMemory()
 {
-    // Initialize memory as required
-    memset(data, 0, sizeof(data));
+    // Every page starts as the shared zero page and is allocated on its first write
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        pages[page] = PageCache::zero_page();
+        page_data[page] = pages[page]->bytes;
+    }
 }
 
 ByteCodeMemory::~ByteCodeMemory() {}
 
 uint8_t ByteCodeMemory::read(uint16_t address)
 {
-    // Wrap around if the address is out of bounds.
-    address &= 0xFFFF;
-    return data[address];
+    return page_data[address >> 8][address & 0xFF];
 }
 
 void ByteCodeMemory::write(uint16_t address, uint8_t value)
 {
-    // Wrap around if the address is out of bounds.
-    address &= 0xFFFF;
-    data[address] = value;
+    uint32_t page = address >> 8;
+    uint8_t *data = private_pages[page] ? page_data[page] : make_private(page);
+    data[address & 0xFF] = value;
 
     if (address == 0xFF00)
     {
-        LOG_INFO(static_cast<char>(data[address]));
+        if (output)
+        {
+            output->push_back(static_cast<char>(value));
+        }
+        else
+        {
+            LOG_INFO(static_cast<char>(value));
+        }
+    }
+}
+
+void ByteCodeMemory::load_shared(uint16_t address, const uint8_t *bytes, size_t size)
+{
+    uint32_t start = address;
+    uint32_t end = std::min<uint32_t>(start + size, MEMORY_SIZE);
+
+    for (uint32_t page = start / PAGE_SIZE; page * PAGE_SIZE < end; page++)
+    {
+        // Overlay the loaded bytes on the current contents of the page
+        uint32_t page_start = page * PAGE_SIZE;
+        uint8_t contents[PAGE_SIZE];
+        memcpy(contents, page_data[page], PAGE_SIZE);
+        for (uint32_t a = std::max(start, page_start); a < std::min(end, page_start + PAGE_SIZE); a++)
+        {
+            contents[a - page_start] = bytes[a - start];
+        }
+
+        external[page] = false;
+        if (backing)
+        {
+            page_data[page] = pages[page]->bytes;
+            memcpy(page_data[page], contents, PAGE_SIZE);
+        }
+        else
+        {
+            pages[page] = PageCache::global().intern(contents);
+            page_data[page] = pages[page]->bytes;
+            private_pages[page] = false;
+        }
+        dirty[page] = true;
+    }
+}
+
+void ByteCodeMemory::load_private(uint16_t address, const uint8_t *bytes, size_t size)
+{
+    uint32_t start = address;
+    uint32_t end = std::min<uint32_t>(start + size, MEMORY_SIZE);
+
+    for (uint32_t page = start / PAGE_SIZE; page * PAGE_SIZE < end; page++)
+    {
+        if (external[page])
+        {
+            external[page] = false;
+            page_data[page] = pages[page]->bytes;
+            private_pages[page] = backing != nullptr;
+        }
+        uint8_t *target = private_pages[page] ? page_data[page] : make_private(page);
+
+        uint32_t page_start = page * PAGE_SIZE;
+        uint32_t first = std::max(start, page_start);
+        memcpy(target + (first - page_start), bytes + (first - start), std::min(end, page_start + PAGE_SIZE) - first);
+        dirty[page] = true;
+    }
+}
+
+MemorySnapshot ByteCodeMemory::snapshot()
+{
+    MemorySnapshot snapshot;
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        // File pages change under the snapshot, keep a copy instead
+        snapshot.pages[page] = backing && !external[page] ? PageCache::global().intern(page_data[page]) : pages[page];
+    }
+    private_pages.reset();
+    return snapshot;
+}
+
+size_t ByteCodeMemory::restore(const MemorySnapshot &snapshot)
+{
+    size_t restored = 0;
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        if (external[page])
+        {
+            continue;
+        }
+        if (backing)
+        {
+            if (memcmp(page_data[page], snapshot.pages[page]->bytes, PAGE_SIZE) != 0)
+            {
+                memcpy(page_data[page], snapshot.pages[page]->bytes, PAGE_SIZE);
+                dirty[page] = true;
+                restored++;
+            }
+        }
+        else if (pages[page] != snapshot.pages[page])
+        {
+            pages[page] = snapshot.pages[page];
+            page_data[page] = pages[page]->bytes;
+            private_pages[page] = false;
+            dirty[page] = true;
+            restored++;
+        }
+    }
+    return restored;
+}
+
+size_t ByteCodeMemory::private_bytes() const
+{
+    return private_pages.count() * PAGE_SIZE;
+}
+
+const uint8_t *ByteCodeMemory::get_page(uint32_t page) const
+{
+    return page_data[page];
+}
+
+bool ByteCodeMemory::is_zero_page(uint32_t page) const
+{
+    if (backing || external[page])
+    {
+        return std::all_of(page_data[page], page_data[page] + PAGE_SIZE, [](uint8_t byte)
+                           { return byte == 0; });
+    }
+    return pages[page] == PageCache::zero_page();
+}
+
+void ByteCodeMemory::map_page(uint32_t page, std::shared_ptr<MemoryPage> data)
+{
+    external[page] = false;
+    if (backing)
+    {
+        page_data[page] = pages[page]->bytes;
+        memcpy(page_data[page], data->bytes, PAGE_SIZE);
+        dirty[page] = true;
+        return;
+    }
+    pages[page] = std::move(data);
+    page_data[page] = pages[page]->bytes;
+    private_pages[page] = false;
+    dirty[page] = true;
+}
+
+void ByteCodeMemory::map_external(uint32_t page, uint8_t *data, bool writable)
+{
+    page_data[page] = data;
+    external[page] = true;
+    external_writable[page] = writable;
+    private_pages[page] = writable;
+    dirty[page] = true;
+}
+
+void ByteCodeMemory::unmap_external(uint32_t page)
+{
+    page_data[page] = pages[page]->bytes;
+    external[page] = false;
+    private_pages[page] = backing != nullptr;
+    dirty[page] = true;
+}
+
+bool ByteCodeMemory::is_external(uint32_t page) const
+{
+    return external[page];
+}
+
+void ByteCodeMemory::copy(uint16_t destination, uint16_t source, size_t size)
+{
+    size = std::min<size_t>(size, MEMORY_SIZE);
+    if (size == 0 || destination == source)
+    {
+        return;
     }
-}
\ No newline at end of file
+
+    // A destination that starts inside the source is copied from the end
+    bool backward = uint16_t(destination - source) < size;
+    uint16_t from = backward ? source + size - 1 : source;
+    uint16_t to = backward ? destination + size - 1 : destination;
+
+    // Each chunk stays within one source and one destination page
+    while (size > 0)
+    {
+        size_t chunk = backward ? std::min<size_t>({size, size_t(from & 0xFF) + 1, size_t(to & 0xFF) + 1})
+                                : std::min<size_t>({size, PAGE_SIZE - (from & 0xFF), PAGE_SIZE - (to & 0xFF)});
+        uint16_t first_from = backward ? from - (chunk - 1) : from;
+        uint16_t first_to = backward ? to - (chunk - 1) : to;
+
+        uint32_t page = first_to >> 8;
+        if (has_device(page) || has_device(first_from >> 8))
+        {
+            for (size_t i = 0; i < chunk; i++)
+            {
+                size_t offset = backward ? chunk - 1 - i : i;
+                write(first_to + offset, read(first_from + offset));
+            }
+        }
+        else
+        {
+            // Taken before the source, making the page private may move it
+            uint8_t *target = private_pages[page] ? page_data[page] : make_private(page);
+            memmove(target + (first_to & 0xFF), page_data[first_from >> 8] + (first_from & 0xFF), chunk);
+        }
+
+        from = backward ? from - chunk : from + chunk;
+        to = backward ? to - chunk : to + chunk;
+        size -= chunk;
+    }
+}
+
+void ByteCodeMemory::fill(uint16_t destination, uint8_t value, size_t size)
+{
+    size = std::min<size_t>(size, MEMORY_SIZE);
+    while (size > 0)
+    {
+        size_t chunk = std::min<size_t>(size, PAGE_SIZE - (destination & 0xFF));
+        uint32_t page = destination >> 8;
+        if (has_device(page))
+        {
+            for (size_t i = 0; i < chunk; i++)
+            {
+                write(destination + i, value);
+            }
+        }
+        else
+        {
+            uint8_t *target = private_pages[page] ? page_data[page] : make_private(page);
+            memset(target + (destination & 0xFF), value, chunk);
+        }
+
+        destination += chunk;
+        size -= chunk;
+    }
+}
+
+void ByteCodeMemory::write_block(uint16_t destination, const uint8_t *bytes, size_t size)
+{
+    size = std::min<size_t>(size, MEMORY_SIZE);
+    while (size > 0)
+    {
+        size_t chunk = std::min<size_t>(size, PAGE_SIZE - (destination & 0xFF));
+        uint32_t page = destination >> 8;
+        if (has_device(page))
+        {
+            for (size_t i = 0; i < chunk; i++)
+            {
+                write(destination + i, bytes[i]);
+            }
+        }
+        else
+        {
+            uint8_t *target = private_pages[page] ? page_data[page] : make_private(page);
+            memcpy(target + (destination & 0xFF), bytes, chunk);
+        }
+
+        destination += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+void ByteCodeMemory::read_block(uint16_t source, uint8_t *bytes, size_t size)
+{
+    size = std::min<size_t>(size, MEMORY_SIZE);
+    while (size > 0)
+    {
+        size_t chunk = std::min<size_t>(size, PAGE_SIZE - (source & 0xFF));
+        if (has_device(source >> 8))
+        {
+            for (size_t i = 0; i < chunk; i++)
+            {
+                bytes[i] = read(source + i);
+            }
+        }
+        else
+        {
+            memcpy(bytes, page_data[source >> 8] + (source & 0xFF), chunk);
+        }
+
+        source += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+void ByteCodeMemory::attach_clock(uint64_t *cycles)
+{
+    clock = cycles;
+}
+
+void ByteCodeMemory::charge_cycles(uint64_t cycles)
+{
+    if (clock)
+    {
+        *clock += cycles;
+    }
+}
+
+uint64_t ByteCodeMemory::get_cycles() const
+{
+    return clock ? *clock : 0;
+}
+
+std::bitset<PAGE_COUNT> ByteCodeMemory::dirty_pages() const
+{
+    return dirty;
+}
+
+void ByteCodeMemory::mark_clean()
+{
+    private_pages.reset();
+    dirty.reset();
+}
+
+bool ByteCodeMemory::back_with_file(const std::string &path)
+{
+    std::shared_ptr<MappedFile> file = MappedFile::open_shared(path, MEMORY_SIZE);
+    if (!file)
+    {
+        LOG_WARN("Could not map " + path + " as memory");
+        return false;
+    }
+
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        external[page] = false;
+        memcpy(file->data() + page * PAGE_SIZE, page_data[page], PAGE_SIZE);
+        pages[page] = MappedFile::page(file, page * PAGE_SIZE);
+        page_data[page] = pages[page]->bytes;
+        dirty[page] = true;
+    }
+    private_pages.set();
+    backing = std::move(file);
+    return true;
+}
+
+bool ByteCodeMemory::is_file_backed() const
+{
+    return backing != nullptr;
+}
+
+bool ByteCodeMemory::sync()
+{
+    return backing && backing->sync();
+}
+
+void ByteCodeMemory::set_output(std::string *buffer)
+{
+    output = buffer;
+}
+
+void ByteCodeMemory::raise_irq(uint32_t line)
+{
+    irq_lines.fetch_or(line, std::memory_order_relaxed);
+}
+
+void ByteCodeMemory::clear_irq(uint32_t line)
+{
+    irq_lines.fetch_and(~line, std::memory_order_relaxed);
+}
+
+bool ByteCodeMemory::irq_asserted() const
+{
+    return irq_lines.load(std::memory_order_relaxed) != 0;
+}
+
+void ByteCodeMemory::set_input_log(InputLog *log)
+{
+    input_log = log;
+}
+
+InputLog *ByteCodeMemory::get_input_log() const
+{
+    return input_log;
+}
+
+uint8_t *ByteCodeMemory::make_private(uint32_t page)
+{
+    // External pages are written in place, or not at all
+    if (external[page])
+    {
+        if (!external_writable[page])
+        {
+            return discard;
+        }
+        private_pages[page] = true;
+        dirty[page] = true;
+        return page_data[page];
+    }
+
+    // File pages are always written in place, only the write tracking is reset
+    if (backing)
+    {
+        private_pages[page] = true;
+        dirty[page] = true;
+        return page_data[page];
+    }
+
+    // Copy on write: detach from the shared page
+    auto copy = std::make_shared<MemoryPage>(*pages[page]);
+    pages[page] = std::move(copy);
+    page_data[page] = pages[page]->bytes;
+    private_pages[page] = true;
+    dirty[page] = true;
+    return page_data[page];
+}
@@ -1,5 +1,8 @@
 #include "logging.h"
 #include "device.h"
+#include "input_log.h"
+#include <algorithm>
+#include <cstring>
 
 void CharacterDisplayDevice::write(uint16_t address, uint8_t value)
 {
@@ -25,31 +28,126 @@ uint8_t CharacterDisplayDevice::read(uint16_t address)
     return 0;
 }
 
+void CharacterDisplayDevice::set_output(std::string *buffer)
+{
+    output = buffer;
+}
+
+void CharacterDisplayDevice::save_state(std::vector<uint8_t> &out) const
+{
+    out.push_back(character);
+}
+
+bool CharacterDisplayDevice::load_state(const uint8_t *data, size_t size)
+{
+    if (size != 1)
+    {
+        return false;
+    }
+    character = data[0];
+    return true;
+}
+
 void CharacterDisplayDevice::display_character(uint8_t ch)
 {
+    if (output)
+    {
+        output->push_back(static_cast<char>(ch));
+        return;
+    }
     LOG_INFO(static_cast<char>(ch));
 }
 
 void CharacterDisplayDevice::clear()
 {
+    if (output)
+    {
+        output->push_back('\f');
+        return;
+    }
     LOG_INFO("[CLEAR]");
 }
 
-ExtendedMemory::ExtendedMemory(std::unique_ptr<CharacterDisplayDevice> device) : device(std::move(device)) {}
+void InputBufferDevice::write(uint16_t address, uint8_t value)
+{
+    // Read only
+}
+
+uint8_t InputBufferDevice::read(uint16_t address)
+{
+    if (address % 2 == 0)
+    {
+        return position < size ? data[position++] : 0;
+    }
+    size_t remaining = size - position;
+    return remaining > 0xFF ? 0xFF : static_cast<uint8_t>(remaining);
+}
+
+void InputBufferDevice::set_input(const uint8_t *input, size_t input_size)
+{
+    data = input;
+    size = input_size;
+    position = 0;
+}
+
+void InputBufferDevice::save_state(std::vector<uint8_t> &out) const
+{
+    uint64_t saved = position;
+    out.insert(out.end(), reinterpret_cast<const uint8_t *>(&saved), reinterpret_cast<const uint8_t *>(&saved + 1));
+}
+
+bool InputBufferDevice::load_state(const uint8_t *data, size_t size)
+{
+    uint64_t saved;
+    if (size != sizeof(saved))
+    {
+        return false;
+    }
+    memcpy(&saved, data, sizeof(saved));
+    position = std::min<size_t>(saved, this->size);
+    return true;
+}
+
+ExtendedMemory::ExtendedMemory(std::unique_ptr<CharacterDisplayDevice> device)
+{
+    attach(std::move(device), DISPLAY_BASE, DISPLAY_BASE + 0xFF);
+}
 
 uint8_t ExtendedMemory::read(uint16_t address)
 {
-    if (is_device_address(address))
+    Device *device = device_pages[address >> 8];
+    if (!device)
+    {
+        return ByteCodeMemory::read(address);
+    }
+    page_accesses[address >> 8]++;
+
+    if (!input_log)
     {
         return device->read(address);
     }
-    return ByteCodeMemory::read(address);
+
+    // Device reads are the bus' nondeterministic input
+    uint8_t value;
+    if (input_log->is_replaying() && input_log->replay_device_read(value))
+    {
+        device->replay_read(address);
+        return value;
+    }
+    value = device->read(address);
+    if (!input_log->is_replaying())
+    {
+        input_log->record_device_read(value);
+    }
+    return value;
 }
 
 void ExtendedMemory::write(uint16_t address, uint8_t value)
 {
-    if (is_device_address(address))
+    Device *device = device_pages[address >> 8];
+    if (device)
     {
+        page_accesses[address >> 8]++;
         device->write(address, value);
     }
     else
@@ -58,7 +156,136 @@ void ExtendedMemory::write(uint16_t address, uint8_t value)
     }
 }
 
-bool ExtendedMemory::is_device_address(uint16_t address) const
+void ExtendedMemory::set_output(std::string *buffer)
+{
+    ByteCodeMemory::set_output(buffer);
+    for (auto &device : devices)
+    {
+        device->set_output(buffer);
+    }
+}
+
+bool ExtendedMemory::has_device(uint32_t page) const
 {
-    return address >= 0xD000 && address <= 0xDFFF; // Assuming device occupies 0xD000-0xDFFF
-}
\ No newline at end of file
+    return device_pages[page] != nullptr;
+}
+
+void ExtendedMemory::save_device_state(std::vector<uint8_t> &out) const
+{
+    for (const auto &device : devices)
+    {
+        std::vector<uint8_t> state;
+        device->save_state(state);
+
+        uint8_t name_length = strlen(device->get_name());
+        out.push_back(name_length);
+        out.insert(out.end(), device->get_name(), device->get_name() + name_length);
+
+        uint32_t length = state.size();
+        out.insert(out.end(), reinterpret_cast<const uint8_t *>(&length), reinterpret_cast<const uint8_t *>(&length + 1));
+        out.insert(out.end(), state.begin(), state.end());
+    }
+}
+
+bool ExtendedMemory::load_device_state(const uint8_t *data, size_t size)
+{
+    // Check every record before loading any, so a mismatch leaves all devices untouched
+    std::vector<std::pair<size_t, uint32_t>> records;
+    size_t offset = 0;
+    for (auto &device : devices)
+    {
+        std::string name = device->get_name();
+        if (offset >= size)
+        {
+            LOG_WARN("Device state has no " + name + " device, it was saved with fewer devices attached.");
+            return false;
+        }
+        uint8_t name_length = data[offset++];
+        uint32_t length;
+        if (offset + name_length + sizeof(length) > size)
+        {
+            LOG_WARN("Device state is truncated.");
+            return false;
+        }
+        std::string saved(reinterpret_cast<const char *>(data + offset), name_length);
+        offset += name_length;
+        if (saved != name)
+        {
+            LOG_WARN("Device state has a " + saved + " device where " + name + " is attached.");
+            return false;
+        }
+
+        memcpy(&length, data + offset, sizeof(length));
+        offset += sizeof(length);
+        if (offset + length > size)
+        {
+            LOG_WARN("Device state is truncated.");
+            return false;
+        }
+        records.emplace_back(offset, length);
+        offset += length;
+    }
+    if (offset != size)
+    {
+        std::string extra(reinterpret_cast<const char *>(data + offset + 1), std::min<size_t>(data[offset], size - offset - 1));
+        LOG_WARN("Device state has a " + extra + " device that is not attached.");
+        return false;
+    }
+
+    // A device can still reject its own state, put back the ones already loaded
+    std::vector<std::vector<uint8_t>> previous(devices.size());
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        devices[i]->save_state(previous[i]);
+    }
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (!devices[i]->load_state(data + records[i].first, records[i].second))
+        {
+            LOG_WARN(std::string("Device state of ") + devices[i]->get_name() + " does not load.");
+            for (size_t j = 0; j < i; j++)
+            {
+                devices[j]->load_state(previous[j].data(), previous[j].size());
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void ExtendedMemory::get_device_accesses(std::vector<DeviceAccesses> &out) const
+{
+    out.clear();
+    for (const auto &device : devices)
+    {
+        out.push_back({device->get_name(), 0});
+    }
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        for (size_t i = 0; i < devices.size() && device_pages[page]; i++)
+        {
+            if (devices[i].get() == device_pages[page])
+            {
+                out[i].count += page_accesses[page];
+            }
+        }
+    }
+}
+
+void ExtendedMemory::map_alias(Device *device, uint16_t start, uint16_t end)
+{
+    for (uint32_t page = start >> 8; page <= static_cast<uint32_t>(end >> 8); page++)
+    {
+        device_pages[page] = device;
+    }
+}
+
+void ExtendedMemory::map_device(std::unique_ptr<Device> device, uint16_t start, uint16_t end)
+{
+    for (uint32_t page = start >> 8; page <= static_cast<uint32_t>(end >> 8); page++)
+    {
+        device_pages[page] = device.get();
+    }
+    device->connect(this);
+    devices.push_back(std::move(device));
+}
@@ -0,0 +1,95 @@
+#include "dma_device.h"
+#include <cstring>
+
+// Register offsets
+static constexpr uint8_t DMA_SOURCE = 0;
+static constexpr uint8_t DMA_DESTINATION = 2;
+static constexpr uint8_t DMA_LENGTH = 4;
+static constexpr uint8_t DMA_FILL = 6;
+static constexpr uint8_t DMA_MODE = 7;
+
+DmaDevice::DmaDevice(uint32_t cycles_per_byte, uint32_t setup_cycles) : cycles_per_byte(cycles_per_byte), setup_cycles(setup_cycles) {}
+
+void DmaDevice::connect(ByteCodeMemory *memory)
+{
+    bus = memory;
+}
+
+void DmaDevice::write(uint16_t address, uint8_t value)
+{
+    uint8_t reg = address & 0xFF;
+    if (reg < DMA_MODE)
+    {
+        registers[reg] = value;
+    }
+    else if (reg == DMA_MODE)
+    {
+        registers[reg] = value;
+        transfer(static_cast<DmaMode>(value));
+    }
+}
+
+uint8_t DmaDevice::read(uint16_t address)
+{
+    uint8_t reg = address & 0xFF;
+    return reg <= DMA_MODE ? registers[reg] : 0;
+}
+
+void DmaDevice::transfer(DmaMode mode)
+{
+    uint16_t source = registers[DMA_SOURCE] | registers[DMA_SOURCE + 1] << 8;
+    uint16_t destination = registers[DMA_DESTINATION] | registers[DMA_DESTINATION + 1] << 8;
+    uint16_t length = registers[DMA_LENGTH] | registers[DMA_LENGTH + 1] << 8;
+    if (!bus || length == 0)
+    {
+        return;
+    }
+
+    switch (mode)
+    {
+    case DmaMode::COPY:
+        bus->copy(destination, source, length);
+        break;
+    case DmaMode::FILL:
+        bus->fill(destination, registers[DMA_FILL], length);
+        break;
+    case DmaMode::FROM_DEVICE:
+        // Through the bus, so device reads are logged like the CPU's
+        for (uint16_t i = 0; i < length; i++)
+        {
+            bus->write(destination + i, bus->read(source));
+        }
+        break;
+    case DmaMode::TO_DEVICE:
+        for (uint16_t i = 0; i < length; i++)
+        {
+            bus->write(destination, bus->read(source + i));
+        }
+        break;
+    default:
+        return;
+    }
+
+    transferred += length;
+    bus->charge_cycles(setup_cycles + uint64_t(length) * cycles_per_byte);
+}
+
+uint64_t DmaDevice::get_transferred() const
+{
+    return transferred;
+}
+
+void DmaDevice::save_state(std::vector<uint8_t> &out) const
+{
+    out.insert(out.end(), registers, registers + sizeof(registers));
+}
+
+bool DmaDevice::load_state(const uint8_t *data, size_t size)
+{
+    if (size != sizeof(registers))
+    {
+        return false;
+    }
+    memcpy(registers, data, sizeof(registers));
+    return true;
+}
@@ -0,0 +1,81 @@
+#include "emu6502.h"
+#include "assembler.h"
+#include "device.h"
+#include "processor.h"
+
+struct emu6502_machine
+{
+    emu6502_machine()
+        : cpu(std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>())) {}
+
+    Processor cpu;
+};
+
+emu6502_machine *emu6502_create(void)
+{
+    return new emu6502_machine();
+}
+
+void emu6502_destroy(emu6502_machine *machine)
+{
+    delete machine;
+}
+
+int emu6502_load(emu6502_machine *machine, uint16_t address, const uint8_t *data, size_t size)
+{
+    if (address + size > MEMORY_SIZE)
+    {
+        return -1;
+    }
+
+    // Identical images loaded by several machines share their pages
+    machine->cpu.get_memory().load_shared(address, data, size);
+    return 0;
+}
+
+size_t emu6502_load_asm(emu6502_machine *machine, const char *path)
+{
+    std::vector<uint8_t> program = interpret(path);
+    if (emu6502_load(machine, 0x8000, program.data(), program.size()) != 0)
+    {
+        return 0;
+    }
+    return program.size();
+}
+
+void emu6502_reset(emu6502_machine *machine, uint16_t pc)
+{
+    machine->cpu.reset();
+    machine->cpu.set_PC(pc);
+}
+
+uint64_t emu6502_run(emu6502_machine *machine, uint64_t max_steps)
+{
+    return machine->cpu.run(max_steps);
+}
+
+void emu6502_get_registers(emu6502_machine *machine, emu6502_registers *registers)
+{
+    Registers state = machine->cpu.get_registers();
+    registers->a = state.A;
+    registers->x = state.X;
+    registers->y = state.Y;
+    registers->status = state.status;
+    registers->pc = state.PC;
+    registers->sp = state.SP;
+}
+
+void emu6502_set_registers(emu6502_machine *machine, const emu6502_registers *registers)
+{
+    machine->cpu.set_registers({registers->a, registers->x, registers->y, registers->status, registers->pc, registers->sp});
+}
+
+uint8_t emu6502_read(emu6502_machine *machine, uint16_t address)
+{
+    return machine->cpu.get_memory().read(address);
+}
+
+void emu6502_write(emu6502_machine *machine, uint16_t address, uint8_t value)
+{
+    machine->cpu.get_memory().write(address, value);
+}
@@ -0,0 +1,211 @@
+#include "framebuffer_device.h"
+#include "logging.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// Control register offsets
+static constexpr uint8_t FRAMEBUFFER_PALETTE = 0x00;
+static constexpr uint8_t FRAMEBUFFER_END_FRAME = 0x30;
+static constexpr uint8_t FRAMEBUFFER_FRAME = 0x31;
+
+// The CGA colours
+static constexpr uint8_t DEFAULT_PALETTE[16 * 3] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0xAA, 0x00, 0xAA, 0x00, 0x00, 0xAA, 0xAA,
+    0xAA, 0x00, 0x00, 0xAA, 0x00, 0xAA, 0xAA, 0x55, 0x00, 0xAA, 0xAA, 0xAA,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0xFF, 0x55, 0xFF, 0x55, 0x55, 0xFF, 0xFF,
+    0xFF, 0x55, 0x55, 0xFF, 0x55, 0xFF, 0xFF, 0xFF, 0x55, 0xFF, 0xFF, 0xFF};
+
+FramebufferDevice::FramebufferDevice(uint16_t base, uint64_t frame_cycles)
+    : base(base), frame_cycles(frame_cycles), next_frame(frame_cycles ? frame_cycles : UINT64_MAX),
+      rgba(FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT)
+{
+    memcpy(palette, DEFAULT_PALETTE, sizeof(palette));
+    dirty_rows.set();
+}
+
+void FramebufferDevice::connect(ByteCodeMemory *memory)
+{
+    bus = memory;
+    if (frame_cycles)
+    {
+        next_frame = (bus->get_cycles() / frame_cycles + 1) * frame_cycles;
+    }
+}
+
+void FramebufferDevice::write(uint16_t address, uint8_t value)
+{
+    // A write after the frame boundary belongs to the next frame
+    catch_up();
+
+    if (address >= base)
+    {
+        uint32_t offset = address - base;
+        if (offset < FRAMEBUFFER_SIZE && video[offset] != value)
+        {
+            video[offset] = value;
+            dirty_rows[offset / FRAMEBUFFER_PITCH] = true;
+        }
+        return;
+    }
+
+    uint8_t reg = address & 0xFF;
+    if (reg < FRAMEBUFFER_PALETTE + sizeof(palette))
+    {
+        if (palette[reg] != value)
+        {
+            palette[reg] = value;
+            dirty_rows.set();
+        }
+    }
+    else if (reg == FRAMEBUFFER_END_FRAME)
+    {
+        end_frame();
+    }
+}
+
+uint8_t FramebufferDevice::read(uint16_t address)
+{
+    catch_up();
+
+    if (address >= base)
+    {
+        uint32_t offset = address - base;
+        return offset < FRAMEBUFFER_SIZE ? video[offset] : 0;
+    }
+
+    uint8_t reg = address & 0xFF;
+    if (reg < FRAMEBUFFER_PALETTE + sizeof(palette))
+    {
+        return palette[reg];
+    }
+    return reg == FRAMEBUFFER_FRAME ? frame & 0xFF : 0;
+}
+
+void FramebufferDevice::catch_up()
+{
+    if (!bus || bus->get_cycles() < next_frame)
+    {
+        return;
+    }
+
+    // Frames without accesses in between had nothing new to show, one end covers them all
+    end_frame();
+    uint64_t cycles = bus->get_cycles();
+    frame += (cycles - next_frame) / frame_cycles;
+    next_frame = (cycles / frame_cycles + 1) * frame_cycles;
+}
+
+void FramebufferDevice::end_frame()
+{
+    // Only rows written since the last frame are converted
+    if (dirty_rows.any())
+    {
+        for (uint32_t row = 0; row < FRAMEBUFFER_HEIGHT; row++)
+        {
+            if (!dirty_rows[row])
+            {
+                continue;
+            }
+            const uint8_t *pixels = video + row * FRAMEBUFFER_PITCH;
+            uint32_t *out = rgba.data() + row * FRAMEBUFFER_WIDTH;
+            for (uint32_t x = 0; x < FRAMEBUFFER_WIDTH; x++)
+            {
+                uint8_t colour = x % 2 ? pixels[x / 2] & 0x0F : pixels[x / 2] >> 4;
+                const uint8_t *rgb = palette + colour * 3;
+                out[x] = 0xFF000000u | uint32_t(rgb[2]) << 16 | uint32_t(rgb[1]) << 8 | rgb[0];
+            }
+            rows_rendered++;
+        }
+        dirty_rows.reset();
+        changed = true;
+    }
+
+    if (changed && !dump_directory.empty())
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%06llu.ppm", static_cast<unsigned long long>(frame));
+        if (!dump(dump_directory + name))
+        {
+            LOG_WARN("Could not write frame to " + dump_directory + name);
+        }
+    }
+    changed = false;
+    frame++;
+}
+
+void FramebufferDevice::flush(bool end)
+{
+    catch_up();
+    if (end)
+    {
+        end_frame();
+    }
+}
+
+bool FramebufferDevice::dump(const std::string &path) const
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << "P6\n"
+         << FRAMEBUFFER_WIDTH << " " << FRAMEBUFFER_HEIGHT << "\n255\n";
+
+    std::vector<uint8_t> rgb(FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 3);
+    for (size_t i = 0; i < rgba.size(); i++)
+    {
+        rgb[i * 3] = rgba[i] & 0xFF;
+        rgb[i * 3 + 1] = (rgba[i] >> 8) & 0xFF;
+        rgb[i * 3 + 2] = (rgba[i] >> 16) & 0xFF;
+    }
+    file.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+    return static_cast<bool>(file);
+}
+
+void FramebufferDevice::set_dump_directory(const std::string &directory)
+{
+    dump_directory = directory;
+    if (!directory.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+    }
+}
+
+const uint32_t *FramebufferDevice::get_rgba() const
+{
+    return rgba.data();
+}
+
+uint64_t FramebufferDevice::get_frame() const
+{
+    return frame;
+}
+
+uint64_t FramebufferDevice::get_rows_rendered() const
+{
+    return rows_rendered;
+}
+
+void FramebufferDevice::save_state(std::vector<uint8_t> &out) const
+{
+    out.insert(out.end(), video, video + sizeof(video));
+    out.insert(out.end(), palette, palette + sizeof(palette));
+    out.insert(out.end(), reinterpret_cast<const uint8_t *>(&frame), reinterpret_cast<const uint8_t *>(&frame + 1));
+}
+
+bool FramebufferDevice::load_state(const uint8_t *data, size_t size)
+{
+    if (size != sizeof(video) + sizeof(palette) + sizeof(frame))
+    {
+        return false;
+    }
+    memcpy(video, data, sizeof(video));
+    memcpy(palette, data + sizeof(video), sizeof(palette));
+    memcpy(&frame, data + sizeof(video) + sizeof(palette), sizeof(frame));
+    dirty_rows.set();
+    if (bus && frame_cycles)
+    {
+        next_frame = (bus->get_cycles() / frame_cycles + 1) * frame_cycles;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#include "fuzz_harness.h"
+
+static std::unique_ptr<ExtendedMemory> make_fuzz_memory()
+{
+    auto memory = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+
+    // Fuzzed programs print a lot, drop it
+    static thread_local std::string discarded;
+    memory->set_output(&discarded);
+    return memory;
+}
+
+FuzzHarness::FuzzHarness(const std::vector<uint8_t> &firmware, uint16_t load_address, uint16_t entry, uint64_t max_steps)
+    : cpu(make_fuzz_memory()), max_steps(max_steps), coverage(COVERAGE_MAP_SIZE)
+{
+    memory = static_cast<ExtendedMemory *>(&cpu.get_memory());
+    input = memory->attach(std::make_unique<InputBufferDevice>(), INPUT_BASE, INPUT_BASE + 0xFF);
+    memory->load_shared(load_address, firmware.data(), firmware.size());
+
+    cpu.reset();
+    cpu.set_PC(entry);
+    initial_registers = cpu.get_registers();
+    initial_memory = memory->snapshot();
+
+    set_coverage_map(coverage.data());
+}
+
+FuzzOutcome FuzzHarness::run(const uint8_t *data, size_t size)
+{
+    // O(dirty pages) reset to the post boot state
+    memory->restore(initial_memory);
+    cpu.set_registers(initial_registers);
+    input->set_input(data, size);
+
+    uint64_t steps = cpu.run(max_steps);
+
+    switch (cpu.get_fault())
+    {
+    case Fault::UNKNOWN_OPCODE:
+        return FuzzOutcome::UNKNOWN_OPCODE;
+    case Fault::STACK_OVERFLOW:
+        return FuzzOutcome::STACK_OVERFLOW;
+    case Fault::STACK_UNDERFLOW:
+        return FuzzOutcome::STACK_UNDERFLOW;
+    case Fault::NONE:
+        break;
+    }
+
+    if (steps >= max_steps && !cpu.is_halted())
+    {
+        return FuzzOutcome::TIMEOUT;
+    }
+    return FuzzOutcome::OK;
+}
+
+void FuzzHarness::set_coverage_map(uint8_t *map)
+{
+    coverage_map = map;
+    cpu.set_coverage_map(map);
+}
+
+uint8_t *FuzzHarness::get_coverage_map()
+{
+    return coverage_map;
+}
@@ -0,0 +1,200 @@
+#include "hot_reload.h"
+#include "byte_code_memory.h"
+#include "logging.h"
+#include "processor.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Editors touch a file several times per save, events this close together are one change
+static constexpr int SETTLE_MS = 20;
+
+static constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE;
+
+static std::string normalize(const std::string &path)
+{
+    std::error_code error;
+    return fs::absolute(path, error).lexically_normal().string();
+}
+
+HotReloader::HotReloader(const std::string &filename, uint16_t origin)
+    : filename(filename), origin(origin), inotify_fd(-1), reloads(0), patched_bytes(0) {}
+
+HotReloader::~HotReloader()
+{
+    if (inotify_fd >= 0)
+    {
+        close(inotify_fd);
+    }
+}
+
+bool HotReloader::load(ByteCodeMemory &memory)
+{
+    if (!assemble(filename, origin, image))
+    {
+        return false;
+    }
+    memory.load_shared(origin, image.byte_code.data(), image.byte_code.size());
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+        LOG_WARN("Cannot watch sources: " + std::string(strerror(errno)));
+        return false;
+    }
+    watch_sources();
+    return true;
+}
+
+void HotReloader::watch_sources()
+{
+    // An include added by the last edit may live in a directory not watched yet
+    sources.clear();
+    for (const std::string &source : image.sources)
+    {
+        std::string path = normalize(source);
+        sources.insert(path);
+
+        std::string directory = fs::path(path).parent_path().string();
+        int watch = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_EVENTS);
+        if (watch < 0)
+        {
+            LOG_WARN("Cannot watch " + directory + ": " + strerror(errno));
+            continue;
+        }
+        directories[watch] = directory;
+    }
+}
+
+bool HotReloader::wait(int timeout_ms)
+{
+    bool changed = false;
+    pollfd watched = {inotify_fd, POLLIN, 0};
+    while (poll(&watched, 1, changed ? SETTLE_MS : timeout_ms) > 0)
+    {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t size;
+        while ((size = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *cursor = buffer; cursor < buffer + size;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(cursor);
+                auto directory = directories.find(event->wd);
+                if (event->len && directory != directories.end() &&
+                    sources.count(directory->second + "/" + event->name))
+                {
+                    changed = true;
+                }
+                cursor += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (!changed)
+        {
+            // Only other files in the watched directories changed
+            break;
+        }
+    }
+    return changed;
+}
+
+bool HotReloader::reload(Processor &cpu)
+{
+    auto started = std::chrono::steady_clock::now();
+
+    Assembly next;
+    if (!assemble(filename, origin, next))
+    {
+        LOG_WARN("Reassembling " + filename + " failed, keeping the running program.");
+        return false;
+    }
+    if (origin + next.byte_code.size() > MEMORY_SIZE)
+    {
+        LOG_WARN(filename + " no longer fits in memory, keeping the running program.");
+        return false;
+    }
+
+    // Bytes past the end of a shrunk program become BRK
+    size_t size = std::max(image.byte_code.size(), next.byte_code.size());
+    std::vector<uint8_t> previous = image.byte_code;
+    std::vector<uint8_t> patched = next.byte_code;
+    previous.resize(size, static_cast<uint8_t>(OpCode::BRK));
+    patched.resize(size, static_cast<uint8_t>(OpCode::BRK));
+
+    ByteCodeMemory &memory = cpu.get_memory();
+    size_t bytes = 0, runs = 0;
+    for (size_t offset = 0; offset < size;)
+    {
+        if (previous[offset] == patched[offset])
+        {
+            offset++;
+            continue;
+        }
+        size_t end = offset;
+        while (end < size && previous[end] != patched[end])
+        {
+            end++;
+        }
+        memory.load_private(origin + offset, patched.data() + offset, end - offset);
+        bytes += end - offset;
+        runs++;
+        offset = end;
+    }
+
+    image = std::move(next);
+    watch_sources();
+    reloads++;
+    patched_bytes += bytes;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    LOG_INFO("Reloaded " + filename + ": patched " + std::to_string(bytes) + " bytes in " + std::to_string(runs) +
+             " runs in " + std::to_string(elapsed.count()) + " us.");
+
+    bool stopped = cpu.is_halted() || cpu.get_fault() != Fault::NONE;
+    if (!restart_label.empty())
+    {
+        auto symbol = image.symbols.find(restart_label);
+        if (symbol == image.symbols.end())
+        {
+            LOG_WARN("Restart label " + restart_label + " is not defined.");
+        }
+        else
+        {
+            cpu.reset();
+            cpu.set_PC(symbol->second);
+            return true;
+        }
+    }
+    if (stopped)
+    {
+        cpu.reset();
+        cpu.set_PC(origin);
+    }
+    return true;
+}
+
+void HotReloader::set_restart_label(const std::string &label)
+{
+    restart_label = label;
+}
+
+const std::map<std::string, uint16_t> &HotReloader::get_symbols() const
+{
+    return image.symbols;
+}
+
+uint32_t HotReloader::get_reloads() const
+{
+    return reloads;
+}
+
+uint64_t HotReloader::get_patched_bytes() const
+{
+    return patched_bytes;
+}
@@ -0,0 +1,100 @@
+#include "input_log.h"
+#include <algorithm>
+
+bool InputLog::is_replaying() const
+{
+    return replaying;
+}
+
+void InputLog::set_replaying(bool replay)
+{
+    replaying = replay;
+    if (!replaying)
+    {
+        device_reads.resize(position.device_reads);
+        interrupts.resize(position.interrupts);
+        host_values.resize(position.host_values);
+        blocks.resize(position.block_bytes);
+    }
+}
+
+InputLog::Position InputLog::get_position() const
+{
+    return position;
+}
+
+void InputLog::seek(const Position &new_position)
+{
+    position = new_position;
+}
+
+bool InputLog::replay_device_read(uint8_t &value)
+{
+    if (position.device_reads >= device_reads.size())
+    {
+        return false;
+    }
+    value = device_reads[position.device_reads++];
+    return true;
+}
+
+void InputLog::record_device_read(uint8_t value)
+{
+    device_reads.push_back(value);
+    position.device_reads++;
+}
+
+bool InputLog::interrupt(uint64_t cycle, bool asserted)
+{
+    if (replaying)
+    {
+        if (position.interrupts < interrupts.size() && interrupts[position.interrupts] == cycle)
+        {
+            position.interrupts++;
+            return true;
+        }
+        return false;
+    }
+
+    if (asserted)
+    {
+        interrupts.push_back(cycle);
+        position.interrupts++;
+    }
+    return asserted;
+}
+
+uint64_t InputLog::host_value(uint64_t live)
+{
+    if (replaying && position.host_values < host_values.size())
+    {
+        return host_values[position.host_values++];
+    }
+
+    host_values.push_back(live);
+    position.host_values++;
+    return live;
+}
+
+bool InputLog::block(uint8_t *bytes, size_t size)
+{
+    if (replaying)
+    {
+        if (position.block_bytes + size > blocks.size())
+        {
+            return false;
+        }
+        std::copy(blocks.begin() + position.block_bytes, blocks.begin() + position.block_bytes + size, bytes);
+        position.block_bytes += size;
+        return true;
+    }
+
+    blocks.insert(blocks.end(), bytes, bytes + size);
+    position.block_bytes += size;
+    return true;
+}
+
+size_t InputLog::size_bytes() const
+{
+    return device_reads.size() + blocks.size() + (interrupts.size() + host_values.size()) * sizeof(uint64_t);
+}
@@ -0,0 +1,434 @@
+#include "job_server.h"
+#include "device.h"
+#include "dma_device.h"
+#include "math_device.h"
+#include "logging.h"
+#include "processor.h"
+#include "result_cache.h"
+#include <chrono>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Steps between checks of the job's deadline
+static constexpr uint32_t DEADLINE_CHECK_INTERVAL = 4096;
+
+// Bytes requested from the socket per read, every complete request in it is queued at once
+static constexpr size_t READ_CHUNK = 64 * 1024;
+
+// Larger requests are treated as a broken stream rather than buffered
+static constexpr uint32_t MAX_INPUT_SIZE = 16 * 1024 * 1024;
+
+struct JobServer::Connection
+{
+    Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    // Responses from several workers interleave, each is written whole under the lock
+    bool send(const JobResponseHeader &header, const std::string &output)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+
+        iovec parts[2] = {{const_cast<JobResponseHeader *>(&header), sizeof(header)},
+                          {const_cast<char *>(output.data()), output.size()}};
+        msghdr message = {};
+        message.msg_iov = parts;
+        message.msg_iovlen = 2;
+
+        size_t remaining = sizeof(header) + output.size();
+        while (remaining > 0)
+        {
+            ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                return false;
+            }
+            remaining -= sent;
+
+            // Skip what went out and send the rest
+            while (sent > 0 && message.msg_iovlen > 0)
+            {
+                size_t part = std::min<size_t>(sent, message.msg_iov->iov_len);
+                message.msg_iov->iov_base = static_cast<uint8_t *>(message.msg_iov->iov_base) + part;
+                message.msg_iov->iov_len -= part;
+                sent -= part;
+                if (message.msg_iov->iov_len == 0)
+                {
+                    message.msg_iov++;
+                    message.msg_iovlen--;
+                }
+            }
+        }
+        return true;
+    }
+
+    int fd;
+    std::mutex write_mutex;
+};
+
+struct JobServer::Job
+{
+    JobRequestHeader header;
+    std::vector<uint8_t> image;
+    std::vector<uint8_t> input;
+    std::shared_ptr<Connection> connection;
+};
+
+// A machine is built once per worker. Between jobs its memory is restored to the snapshot
+// taken while it was pristine, which only touches the pages the previous job wrote.
+struct JobServer::Machine
+{
+    Machine()
+    {
+        auto extended = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+        input = extended->attach(std::make_unique<InputBufferDevice>(), INPUT_BASE, INPUT_BASE + 0xFF);
+        extended->attach(std::make_unique<DmaDevice>(), DMA_BASE, DMA_BASE + 0xFF);
+        extended->attach(std::make_unique<MathDevice>(), MATH_BASE, MATH_BASE + 0xFF);
+        extended->set_output(&output);
+        memory = extended.get();
+        cpu = std::make_unique<Processor>(std::move(extended));
+
+        clean = memory->snapshot();
+        memory->save_device_state(clean_devices);
+    }
+
+    std::unique_ptr<Processor> cpu;
+    ExtendedMemory *memory;
+    InputBufferDevice *input;
+    MemorySnapshot clean;
+    std::vector<uint8_t> clean_devices;
+    std::string output;
+};
+
+JobServer::JobServer(const JobServerOptions &options) : options(options), listen_fd(-1), stopping(false)
+{
+    if (options.cache_bytes)
+    {
+        cache = std::make_unique<ResultCache>(options.cache_bytes);
+    }
+}
+
+JobServer::~JobServer()
+{
+    stop();
+}
+
+bool JobServer::run()
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (options.socket_path.size() >= sizeof(address.sun_path))
+    {
+        LOG_WARN("Socket path too long: " + options.socket_path);
+        return false;
+    }
+    strncpy(address.sun_path, options.socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(options.socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0)
+    {
+        LOG_WARN("Cannot listen on " + options.socket_path + ": " + strerror(errno));
+        return false;
+    }
+
+    if (cache && !options.cache_path.empty() && !cache->load(options.cache_path))
+    {
+        LOG_WARN("Starting with an empty result cache.");
+    }
+
+    // Machines are allocated up front so no job pays for building one
+    unsigned worker_count = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<Machine>> machines;
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < worker_count; w++)
+    {
+        machines.push_back(std::make_unique<Machine>());
+    }
+    for (unsigned w = 0; w < worker_count; w++)
+    {
+        workers.emplace_back(&JobServer::work, this, std::ref(*machines[w]));
+    }
+    LOG_INFO("Serving on " + options.socket_path + " with " + std::to_string(worker_count) + " machines.");
+
+    while (!stopping)
+    {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        auto connection = std::make_shared<Connection>(fd);
+        std::lock_guard<std::mutex> lock(readers_mutex);
+
+        // A connection expires once its reader returned and its last response was sent
+        for (auto reader = readers.begin(); reader != readers.end();)
+        {
+            if (reader->connection.expired())
+            {
+                reader->thread.join();
+                reader = readers.erase(reader);
+            }
+            else
+            {
+                ++reader;
+            }
+        }
+        readers.push_back({std::thread(&JobServer::serve_connection, this, connection), connection});
+    }
+
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        for (Reader &reader : readers)
+        {
+            reader.thread.join();
+        }
+        readers.clear();
+    }
+    queue_not_empty.notify_all();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(options.socket_path.c_str());
+
+    if (cache)
+    {
+        LOG_INFO("Result cache: " + std::to_string(cache->get_hits()) + " hits, " + std::to_string(cache->get_misses()) +
+                 " misses, " + std::to_string(cache->get_evictions()) + " evictions.");
+        if (!options.cache_path.empty())
+        {
+            cache->save(options.cache_path);
+        }
+    }
+    return true;
+}
+
+void JobServer::stop()
+{
+    if (stopping.exchange(true))
+    {
+        return;
+    }
+
+    // Wake the accept loop and every blocked reader
+    if (listen_fd >= 0)
+    {
+        shutdown(listen_fd, SHUT_RDWR);
+    }
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        for (const Reader &reader : readers)
+        {
+            if (std::shared_ptr<Connection> connection = reader.connection.lock())
+            {
+                shutdown(connection->fd, SHUT_RD);
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue_not_empty.notify_all();
+    queue_not_full.notify_all();
+}
+
+void JobServer::serve_connection(std::shared_ptr<Connection> connection)
+{
+    std::vector<uint8_t> buffer;
+    size_t consumed = 0;
+
+    while (!stopping)
+    {
+        size_t filled = buffer.size();
+        buffer.resize(filled + READ_CHUNK);
+        ssize_t received = recv(connection->fd, buffer.data() + filled, READ_CHUNK, 0);
+        if (received <= 0)
+        {
+            if (received < 0 && errno == EINTR)
+            {
+                buffer.resize(filled);
+                continue;
+            }
+            break;
+        }
+        buffer.resize(filled + received);
+
+        // Queue every complete request in the buffer as one batch
+        std::vector<std::unique_ptr<Job>> batch;
+        while (buffer.size() - consumed >= sizeof(JobRequestHeader))
+        {
+            JobRequestHeader header;
+            memcpy(&header, buffer.data() + consumed, sizeof(header));
+            if (memcmp(header.magic, JOB_REQUEST_MAGIC, sizeof(header.magic)) != 0 ||
+                header.image_size > MEMORY_SIZE || header.input_size > MAX_INPUT_SIZE)
+            {
+                LOG_WARN("Malformed job request, closing connection.");
+                return;
+            }
+
+            size_t size = sizeof(header) + size_t(header.image_size) + header.input_size;
+            if (buffer.size() - consumed < size)
+            {
+                break;
+            }
+
+            auto job = std::make_unique<Job>();
+            job->header = header;
+            const uint8_t *payload = buffer.data() + consumed + sizeof(header);
+            job->image.assign(payload, payload + header.image_size);
+            job->input.assign(payload + header.image_size, payload + header.image_size + header.input_size);
+            job->connection = connection;
+            batch.push_back(std::move(job));
+            consumed += size;
+        }
+
+        if (!enqueue(batch))
+        {
+            return;
+        }
+
+        // Keep only the partial request
+        buffer.erase(buffer.begin(), buffer.begin() + consumed);
+        consumed = 0;
+    }
+}
+
+bool JobServer::enqueue(std::vector<std::unique_ptr<Job>> &batch)
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    for (std::unique_ptr<Job> &job : batch)
+    {
+        queue_not_full.wait(lock, [this]()
+                            { return stopping || queue.size() < options.queue_depth; });
+        if (stopping)
+        {
+            return false;
+        }
+        queue.push_back(std::move(job));
+        queue_not_empty.notify_one();
+    }
+    return true;
+}
+
+std::unique_ptr<JobServer::Job> JobServer::dequeue()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queue_not_empty.wait(lock, [this]()
+                         { return stopping || !queue.empty(); });
+    if (queue.empty())
+    {
+        return nullptr;
+    }
+    std::unique_ptr<Job> job = std::move(queue.front());
+    queue.pop_front();
+    queue_not_full.notify_one();
+    return job;
+}
+
+void JobServer::work(Machine &machine)
+{
+    while (std::unique_ptr<Job> job = dequeue())
+    {
+        execute(machine, *job);
+    }
+}
+
+void JobServer::execute(Machine &machine, Job &job)
+{
+    const JobRequestHeader &request = job.header;
+    Processor &cpu = *machine.cpu;
+
+    JobResponseHeader response = {};
+    memcpy(response.magic, JOB_RESPONSE_MAGIC, sizeof(response.magic));
+    response.job_id = request.job_id;
+
+    machine.output.clear();
+    if (uint32_t(request.load_address) + job.image.size() > MEMORY_SIZE)
+    {
+        response.status = JobStatus::REJECTED;
+        job.connection->send(response, machine.output);
+        return;
+    }
+
+    ResultKey key = {};
+    if (cache)
+    {
+        key = ResultCache::key(request, job.image.data(), job.input.data());
+        if (cache->lookup(key, response, machine.output))
+        {
+            memcpy(response.magic, JOB_RESPONSE_MAGIC, sizeof(response.magic));
+            response.job_id = request.job_id;
+            job.connection->send(response, machine.output);
+            return;
+        }
+    }
+
+    machine.memory->restore(machine.clean);
+    machine.memory->load_device_state(machine.clean_devices.data(), machine.clean_devices.size());
+    machine.input->set_input(job.input.data(), job.input.size());
+    machine.memory->load_private(request.load_address, job.image.data(), job.image.size());
+
+    cpu.reset();
+    cpu.set_cycles(0);
+    cpu.set_PC(request.entry);
+    uint64_t start_instructions = cpu.get_instructions();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(request.timeout_ms);
+    uint64_t max_cycles = request.max_cycles ? request.max_cycles : UINT64_MAX;
+
+    response.status = JobStatus::HALTED;
+    uint32_t until_check = DEADLINE_CHECK_INTERVAL;
+    while (cpu.step())
+    {
+        if (cpu.get_cycles() >= max_cycles)
+        {
+            response.status = JobStatus::CYCLE_BUDGET;
+            break;
+        }
+        if (--until_check == 0)
+        {
+            until_check = DEADLINE_CHECK_INTERVAL;
+            if (request.timeout_ms && std::chrono::steady_clock::now() >= deadline)
+            {
+                response.status = JobStatus::TIMEOUT;
+                break;
+            }
+        }
+    }
+    if (cpu.get_fault() != Fault::NONE)
+    {
+        response.status = JobStatus::FAULT;
+    }
+
+    Registers registers = cpu.get_registers();
+    response.cycles = cpu.get_cycles();
+    response.instructions = cpu.get_instructions() - start_instructions;
+    response.output_size = machine.output.size();
+    response.PC = registers.PC;
+    response.A = registers.A;
+    response.X = registers.X;
+    response.Y = registers.Y;
+    response.flags = registers.status;
+    response.SP = registers.SP;
+
+    if (cache && response.status != JobStatus::TIMEOUT)
+    {
+        cache->insert(key, response, machine.output);
+    }
+
+    // A client that went away only loses its own responses
+    job.connection->send(response, machine.output);
+}
@@ -1,130 +1,548 @@
 #include "logging.h"
 #include "processor.h"
 #include "device.h"
-#include <fstream>
-#include <sstream>
-#include <map>
+#include "assembler.h"
+#include "regression_runner.h"
+#include "pacer.h"
+#include "save_state.h"
+#include "opcode_profile.h"
+#include "job_server.h"
+#include "asm_cache.h"
+#include "state_export.h"
+#include "stats_reporter.h"
+#include "bank_controller.h"
+#include "dma_device.h"
+#include "math_device.h"
+#include "framebuffer_device.h"
+#include "serial_input.h"
+#include "storage_device.h"
+#include "hot_reload.h"
+#include "processor_hooks.h"
+#include <csignal>
+#include <thread>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <string>
 
-const std::map<std::string, OpCode> OPCODE_MAP = {
-    {"LDA", OpCode::LDA_IMM},
-    {"STA", OpCode::STA_ABS},
-    {"BRK", OpCode::BRK}};
+// Window size of --bank-rom
+static constexpr uint32_t BANK_ROM_WINDOW = 8192;
 
-std::vector<uint8_t> interpret(const std::string &filename)
+static void usage(const char *program)
 {
-    std::ifstream file(filename);
-    std::string line;
-    std::vector<uint8_t> byte_code;
+    std::cerr << "Usage: " << program << " [--clock-hz N] [--slice-cycles N] [--load-state path] [--save-state path] [--profile-out path] [--asm-cache dir|off] [--ram-file path] [--export-state name|auto] [--export-interval N] [--stats-interval ms] [--stats-file path] [--bank-rom path] [--framebuffer-dump dir] [--serial-input path|-]... [--storage image] [--sector-size 256|512] [--watch [--restart-at label]] [--hooks none|count|trace[=path]|watch=START-END] <path_to_asm_file>" << std::endl;
+    std::cerr << "       " << program << " --run-corpus <directory> [--jobs N] [--max-steps N] [--report json|junit] [--report-file path]" << std::endl;
+    std::cerr << "       " << program << " --serve <socket_path> [--workers N] [--queue-depth N] [--result-cache MB] [--result-cache-file path]" << std::endl;
+    exit(1);
+}
 
-    int lineNumber = 0;
+static int run_corpus(int argc, char *argv[])
+{
+    RegressionOptions options;
+    ReportFormat format = ReportFormat::JSON;
+    std::string report_file;
 
-    while (getline(file, line))
+    for (int i = 1; i < argc; i++)
     {
-        lineNumber++;
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
 
-        LOG_DEBUG("Processing line " + std::to_string(lineNumber) + ": " + line);
+        std::string value = argv[++i];
+        if (arg == "--run-corpus")
+            options.directory = value;
+        else if (arg == "--jobs")
+            options.jobs = std::stoul(value);
+        else if (arg == "--max-steps")
+            options.max_steps = std::stoull(value);
+        else if (arg == "--report" && (value == "json" || value == "junit"))
+            format = value == "json" ? ReportFormat::JSON : ReportFormat::JUNIT;
+        else if (arg == "--report-file")
+            report_file = value;
+        else
+            usage(argv[0]);
+    }
+
+    // Program output is captured per job, keep the workers quiet
+    current_log_level = LogLevel::LOG_NONE;
 
-        std::istringstream iss(line);
-        std::string instruction;
-        iss >> instruction;
+    double seconds = 0;
+    std::vector<RegressionResult> results = run_regressions(options, &seconds);
 
-        if (OPCODE_MAP.find(instruction) != OPCODE_MAP.end())
+    if (report_file.empty())
+    {
+        write_report(std::cout, results, seconds, format);
+    }
+    else
+    {
+        std::ofstream out(report_file);
+        write_report(out, results, seconds, format);
+    }
+
+    for (const RegressionResult &result : results)
+    {
+        if (!result.passed)
         {
-            OpCode op_code = OPCODE_MAP.at(instruction);
-            byte_code.push_back(static_cast<uint8_t>(op_code));
+            return 1;
+        }
+    }
+    return 0;
+}
 
-            LOG_DEBUG("  Matched instruction: " + instruction + " to opcode: " + std::to_string(static_cast<int>(op_code)));
+static int serve(int argc, char *argv[])
+{
+    JobServerOptions options;
 
-            switch (op_code)
-            {
-            case OpCode::LDA_IMM:
-            {
-                uint16_t value;
-                iss >> std::hex >> value;
-                byte_code.push_back(static_cast<uint8_t>(value));
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
 
-                LOG_DEBUG("    Loaded immediate value: " + std::to_string((int)value));
-            }
-            break;
+        std::string value = argv[++i];
+        if (arg == "--serve")
+            options.socket_path = value;
+        else if (arg == "--workers")
+            options.workers = std::stoul(value);
+        else if (arg == "--queue-depth")
+            options.queue_depth = std::stoull(value);
+        else if (arg == "--result-cache")
+            options.cache_bytes = std::stoull(value) * 1024 * 1024;
+        else if (arg == "--result-cache-file")
+            options.cache_path = value;
+        else
+            usage(argv[0]);
+    }
 
-            case OpCode::STA_ABS:
-            {
-                uint16_t address;
-                iss >> std::hex >> address;
-                byte_code.push_back(static_cast<uint8_t>(address & 0xFF));
-                byte_code.push_back(static_cast<uint8_t>((address >> 8) & 0xFF));
+    // SIGINT/SIGTERM stop the server cleanly, letting queued jobs finish
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-                LOG_DEBUG("    Stored value to absolute address: " + std::to_string((int)address));
-            }
-            break;
+    JobServer server(options);
+    std::thread signal_thread([&]()
+                              {
+        int signal;
+        sigwait(&signals, &signal);
+        server.stop(); });
+    signal_thread.detach();
 
-            default:
-                LOG_DEBUG("    Instruction doesn't require additional bytes.");
-                break;
-            }
+    return server.run() ? 0 : 1;
+}
+
+static void run_steps(Processor &cpu, OpcodeProfile *profile)
+{
+    // Through step, so interrupts are taken and superinstructions fused
+    uint64_t start = cpu.get_instructions();
+    if (profile)
+    {
+        ProfileHooks hooks(*profile);
+        while (cpu.step(hooks))
+        {
         }
-        else
+    }
+    else
+    {
+        while (cpu.step())
         {
-            LOG_WARN("  Instruction " + instruction + " not found in opcode map.");
         }
+    }
 
-        LOG_DEBUG("");
+    if (cpu.get_fault() != Fault::NONE)
+    {
+        LOG_WARN("Processor fault. Exiting loop.");
+    }
+    else
+    {
+        LOG_INFO("Encountered BRK. Exiting loop.");
     }
+    LOG_INFO("Program completed after " + std::to_string(cpu.get_instructions() - start) + " steps.");
+}
+
+// Steps between checks for changed sources in watch mode
+static constexpr uint64_t WATCH_POLL_INTERVAL = 65536;
+
+static volatile sig_atomic_t watch_interrupted = 0;
+
+// Run and patch source changes into the running program until SIGINT. Once the program
+// stops the loop waits for the next change, which restarts it.
+static void run_watching(Processor &cpu, HotReloader &reloader)
+{
+    std::signal(SIGINT, [](int)
+                { watch_interrupted = 1; });
+    LOG_INFO("Watching sources, interrupt to stop.");
 
-    return byte_code;
+    bool running = true;
+    while (!watch_interrupted)
+    {
+        bool was_running = running;
+        for (uint64_t steps = 0; running && steps < WATCH_POLL_INTERVAL && !watch_interrupted; steps++)
+        {
+            running = cpu.step();
+        }
+        if (was_running && !running)
+        {
+            if (cpu.get_fault() != Fault::NONE)
+            {
+                LOG_WARN("Processor fault, waiting for changes.");
+            }
+            else
+            {
+                LOG_INFO("Encountered BRK, waiting for changes.");
+            }
+        }
+
+        // A stopped program is restarted by the reload
+        if (reloader.wait(running ? 0 : -1) && reloader.reload(cpu))
+        {
+            running = !cpu.is_halted() && cpu.get_fault() == Fault::NONE;
+        }
+    }
+    LOG_INFO("Stopped watching after " + std::to_string(reloader.get_reloads()) + " reloads.");
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    if (argc >= 2 && std::string(argv[1]) == "--run-corpus")
+    {
+        return run_corpus(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--serve")
     {
-        std::cerr << "Usage: " << argv[0] << " <path_to_asm_file>" << std::endl;
-        exit(1);
+        return serve(argc, argv);
     }
 
-    std::string asm_file_path = argv[1];
+    std::string asm_file_path;
+    double clock_hz = 0;
+    uint64_t slice_cycles = 1000;
+    std::string load_state_path;
+    std::string save_state_path;
+    std::string profile_path;
+    std::string asm_cache_path = AssemblyCache::default_directory();
+    std::string ram_file_path;
+    std::string export_name;
+    uint64_t export_interval = 100000;
+    std::string bank_rom_path;
+    uint64_t stats_interval_ms = 0;
+    std::string stats_path;
+    std::string framebuffer_dump;
+    std::vector<std::string> serial_inputs;
+    std::string storage_path;
+    uint32_t sector_size = 256;
+    bool watch = false;
+    std::string restart_label;
+    std::string hooks_spec;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+        {
+            if (!asm_file_path.empty())
+            {
+                usage(argv[0]);
+            }
+            asm_file_path = arg;
+            continue;
+        }
+        if (arg == "--watch")
+        {
+            watch = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--clock-hz")
+            clock_hz = std::stod(value);
+        else if (arg == "--slice-cycles")
+            slice_cycles = std::stoull(value);
+        else if (arg == "--load-state")
+            load_state_path = value;
+        else if (arg == "--save-state")
+            save_state_path = value;
+        else if (arg == "--profile-out")
+            profile_path = value;
+        else if (arg == "--asm-cache")
+            asm_cache_path = value;
+        else if (arg == "--ram-file")
+            ram_file_path = value;
+        else if (arg == "--export-state")
+            export_name = value;
+        else if (arg == "--export-interval")
+            export_interval = std::stoull(value);
+        else if (arg == "--stats-interval")
+            stats_interval_ms = std::stoull(value);
+        else if (arg == "--stats-file")
+            stats_path = value;
+        else if (arg == "--serial-input")
+            serial_inputs.push_back(value);
+        else if (arg == "--hooks")
+            hooks_spec = value;
+        else if (arg == "--restart-at")
+            restart_label = value;
+        else if (arg == "--storage")
+            storage_path = value;
+        else if (arg == "--sector-size")
+            sector_size = std::stoul(value);
+        else if (arg == "--framebuffer-dump")
+            framebuffer_dump = value;
+        else if (arg == "--bank-rom")
+            bank_rom_path = value;
+        else
+            usage(argv[0]);
+    }
+
+    // A save state replaces the program
+    if (asm_file_path.empty() == load_state_path.empty() || (sector_size != 256 && sector_size != 512))
+    {
+        usage(argv[0]);
+    }
+    // Watching needs the sources and runs its own loop, as do hooks
+    if ((watch && (asm_file_path.empty() || clock_hz > 0 || !profile_path.empty())) || (!watch && !restart_label.empty()) ||
+        (!hooks_spec.empty() && (watch || clock_hz > 0 || !profile_path.empty())))
+    {
+        usage(argv[0]);
+    }
+    std::unique_ptr<HookedRunner> hooks;
+    if (!hooks_spec.empty() && !(hooks = make_hooked_runner(hooks_spec)))
+    {
+        return 1;
+    }
 
     // Create memory
     auto device = std::make_unique<CharacterDisplayDevice>();
     std::unique_ptr<ExtendedMemory> memory = std::make_unique<ExtendedMemory>(std::move(device));
+    ExtendedMemory *extended = memory.get();
+    extended->attach(std::make_unique<DmaDevice>(), DMA_BASE, DMA_BASE + 0xFF);
+    extended->attach(std::make_unique<MathDevice>(), MATH_BASE, MATH_BASE + 0xFF);
 
     LOG_INFO("Initialized ByteCodeMemory.");
 
-    // Write memory
-    std::vector<uint8_t> program = interpret(asm_file_path);
-    LOG_INFO("Interpreted program.asm into " + std::to_string(program.size()) + " bytes.");
-    for (size_t i = 0; i < program.size(); i++)
-    {
-        memory->write(0x8000 + i, static_cast<uint8_t>(program[i]));
-        LOG_DEBUG("Wrote byte " + std::to_string(i) + " to address " + std::to_string(0x8000 + i) + ": " + std::to_string(static_cast<int>(program[i])));
-    }
-
     // Setup processor
     Processor cpu(std::move(memory));
     LOG_INFO("Initialized Processor and set memory.");
-    cpu.reset();
-    LOG_INFO("Processor reset.");
-    cpu.set_PC(0x8000);
-    LOG_INFO("Program Counter set to 0x8000.");
 
-    // Run code
-    int steps = 0;
-    while (true)
+    // Other processes can map the file to watch memory while the program runs
+    if (!ram_file_path.empty())
+    {
+        if (!cpu.get_memory().back_with_file(ram_file_path))
+        {
+            return 1;
+        }
+        LOG_INFO("Memory backed by " + ram_file_path + ".");
+    }
+
+    // Large ROMs are seen through an 8 KB window at 0xA000, switched by writing BANK_BASE
+    if (!bank_rom_path.empty())
+    {
+        std::ifstream file(bank_rom_path, std::ios::binary);
+        if (!file)
+        {
+            LOG_WARN("Cannot open bank ROM " + bank_rom_path);
+            return 1;
+        }
+        std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        uint32_t bank_count = (rom.size() + BANK_ROM_WINDOW - 1) / BANK_ROM_WINDOW;
+        auto banks = std::make_unique<BankController>(BANK_ROM_WINDOW, bank_count, std::vector<BankWindow>{{0xA000, false}});
+        banks->load(0, rom.data(), rom.size());
+        extended->attach(std::move(banks), BANK_BASE, BANK_BASE + 0xFF);
+        LOG_INFO("Mapped " + std::to_string(bank_count) + " banks of " + bank_rom_path + " at 0xA000.");
+    }
+
+    // Bitmap display, every changed frame is written to the dump directory
+    FramebufferDevice *framebuffer = nullptr;
+    if (!framebuffer_dump.empty())
+    {
+        framebuffer = extended->attach(std::make_unique<FramebufferDevice>(), FRAMEBUFFER_CONTROL_BASE, FRAMEBUFFER_CONTROL_BASE + 0xFF);
+        extended->map_alias(framebuffer, FRAMEBUFFER_BASE, FRAMEBUFFER_BASE + FRAMEBUFFER_SIZE - 1);
+        framebuffer->set_dump_directory(framebuffer_dump);
+        LOG_INFO("Dumping framebuffer frames to " + framebuffer_dump + ".");
+    }
+
+    // Host input arrives through a reactor thread, the CPU never waits for it
+    SerialInputDevice *serial = nullptr;
+    if (!serial_inputs.empty())
+    {
+        serial = extended->attach(std::make_unique<SerialInputDevice>(), SERIAL_BASE, SERIAL_BASE + 0xFF);
+        for (const std::string &path : serial_inputs)
+        {
+            if (!serial->open(path))
+            {
+                return 1;
+            }
+        }
+        serial->start();
+    }
+
+    // Disk image, file I/O happens on the device's worker thread
+    StorageDevice *storage = nullptr;
+    if (!storage_path.empty())
     {
-        OpCode op_code = cpu.fetch_opcode();
-        LOG_DEBUG("Step " + std::to_string(steps++) + ": Fetched opcode " + std::to_string(static_cast<int>(op_code)));
-        if (op_code == OpCode::BRK)
+        storage = extended->attach(std::make_unique<StorageDevice>(sector_size), STORAGE_BASE, STORAGE_BASE + 0xFF);
+        if (!storage->open(storage_path))
         {
-            LOG_INFO("Encountered BRK. Exiting loop.");
-            break;
+            return 1;
+        }
+        LOG_INFO("Attached storage image " + storage_path + " with " + std::to_string(sector_size) + " byte sectors.");
+    }
+
+    // The assembly cache is bypassed in watch mode, the reloader keeps its own image to diff
+    std::unique_ptr<HotReloader> reloader;
+    if (!load_state_path.empty())
+    {
+        if (!load_save_state(load_state_path, cpu))
+        {
+            return 1;
+        }
+        LOG_INFO("Resumed from save state " + load_state_path + ".");
+    }
+    else
+    {
+        // Write memory
+        if (watch)
+        {
+            reloader = std::make_unique<HotReloader>(asm_file_path, PROGRAM_ORIGIN);
+            reloader->set_restart_label(restart_label);
+            if (!reloader->load(cpu.get_memory()))
+            {
+                return 1;
+            }
+            LOG_INFO("Assembled " + asm_file_path + ", watching its sources.");
+        }
+        else if (asm_cache_path == "off")
+        {
+            std::vector<uint8_t> program = interpret(asm_file_path);
+            LOG_INFO("Interpreted program.asm into " + std::to_string(program.size()) + " bytes.");
+            cpu.get_memory().load_shared(PROGRAM_ORIGIN, program.data(), program.size());
+            LOG_DEBUG("Mapped " + std::to_string(program.size()) + " bytes at address " + std::to_string(PROGRAM_ORIGIN) + " as shared pages.");
+        }
+        else
+        {
+            AssemblyCache cache(asm_cache_path);
+            size_t size = 0;
+            if (!cache.load(asm_file_path, PROGRAM_ORIGIN, cpu.get_memory(), nullptr, &size))
+            {
+                return 1;
+            }
+            LOG_INFO(std::string(cache.get_hits() ? "Mapped cached image of " : "Assembled ") + asm_file_path + " into " +
+                     std::to_string(size) + " bytes.");
         }
 
-        cpu.execute(op_code);
-        LOG_DEBUG("Executed opcode.");
+        cpu.reset();
+        LOG_INFO("Processor reset.");
+        cpu.set_PC(0x8000);
+        LOG_INFO("Program Counter set to 0x8000.");
     }
 
-    LOG_INFO("Program completed after " + std::to_string(steps) + " steps.");
+    // Monitoring tools such as emu6502_stat sample the exported state without stopping us
+    std::unique_ptr<StateExporter> exporter;
+    if (!export_name.empty())
+    {
+        exporter = std::make_unique<StateExporter>(export_name == "auto" ? "" : export_name);
+        cpu.set_state_exporter(exporter.get(), export_interval);
+        LOG_INFO("Exporting state to shared memory " + exporter->get_name() + ".");
+    }
+
+    // The reporter samples the exported state, a private segment does without /dev/shm
+    std::unique_ptr<StatsReporter> stats;
+    if (stats_interval_ms > 0)
+    {
+        if (!exporter)
+        {
+            exporter = std::make_unique<StateExporter>("", false);
+            cpu.set_state_exporter(exporter.get(), export_interval);
+        }
+        stats = std::make_unique<StatsReporter>(*exporter, std::chrono::milliseconds(stats_interval_ms), stats_path);
+        stats->start();
+    }
+
+    // Saving into the state we resumed from only appends the pages written since
+    SaveStateWriter save_state(save_state_path, save_state_path == load_state_path);
+
+    if (reloader)
+    {
+        run_watching(cpu, *reloader);
+    }
+    else if (hooks)
+    {
+        uint64_t steps = hooks->run(cpu, UINT64_MAX);
+        LOG_INFO("Program completed after " + std::to_string(steps) + " steps. " + hooks->summary());
+    }
+    else if (clock_hz > 0)
+    {
+        // Real-time mode: no per step logging, it would dominate the timing
+        Pacer pacer(clock_hz, slice_cycles);
+        uint64_t cycles = pacer.run(cpu, UINT64_MAX);
+
+        const PacingStats &stats = pacer.get_stats();
+        LOG_INFO("Program completed after " + std::to_string(cycles) + " cycles at " + std::to_string(clock_hz) + " Hz.");
+        LOG_INFO("Slices: " + std::to_string(stats.slices) + ", missed deadlines: " + std::to_string(stats.missed_deadlines) +
+                 ", resyncs: " + std::to_string(stats.resyncs));
+        LOG_INFO("Lateness mean/jitter/max: " + std::to_string(stats.mean_lateness_us) + "/" + std::to_string(stats.jitter_us) +
+                 "/" + std::to_string(stats.max_lateness_us) + " us, drift: " + std::to_string(stats.drift_us) + " us");
+    }
+    else
+    {
+        OpcodeProfile profile;
+        run_steps(cpu, profile_path.empty() ? nullptr : &profile);
+
+        if (!profile_path.empty())
+        {
+            std::ofstream out(profile_path);
+            profile.write(out);
+            LOG_INFO("Wrote opcode profile to " + profile_path + ".");
+        }
+    }
+
+    if (serial)
+    {
+        serial->stop();
+        LOG_INFO("Received " + std::to_string(serial->get_received()) + " bytes of serial input.");
+    }
+
+    if (storage)
+    {
+        LOG_INFO("Storage cache: " + std::to_string(storage->get_cache_hits()) + " hits, " +
+                 std::to_string(storage->get_cache_misses()) + " misses.");
+    }
+
+    if (framebuffer)
+    {
+        framebuffer->flush();
+        LOG_INFO("Framebuffer showed " + std::to_string(framebuffer->get_frame()) + " frames.");
+    }
+
+    if (stats)
+    {
+        // The final report covers the instructions since the last export
+        exporter->publish(cpu);
+        stats->stop();
+    }
+
+    if (!ram_file_path.empty())
+    {
+        cpu.get_memory().sync();
+    }
+
+    if (!save_state_path.empty())
+    {
+        if (!save_state.save(cpu))
+        {
+            return 1;
+        }
+        LOG_INFO("Saved state to " + save_state_path + ".");
+    }
     return 0;
 }
@@ -0,0 +1,74 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat info;
+    size_t size = fstat(fd, &info) == 0 ? info.st_size : 0;
+    void *data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    return std::make_shared<MappedFile>(static_cast<uint8_t *>(data), size);
+}
+
+std::shared_ptr<MappedFile> MappedFile::open_shared(const std::string &path, size_t size)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    void *data = ftruncate(fd, size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    return std::make_shared<MappedFile>(static_cast<uint8_t *>(data), size);
+}
+
+MappedFile::MappedFile(uint8_t *data, size_t size) : bytes(data), length(size) {}
+
+MappedFile::~MappedFile()
+{
+    munmap(bytes, length);
+}
+
+const uint8_t *MappedFile::data() const
+{
+    return bytes;
+}
+
+uint8_t *MappedFile::data()
+{
+    return bytes;
+}
+
+size_t MappedFile::size() const
+{
+    return length;
+}
+
+bool MappedFile::sync()
+{
+    return msync(bytes, length, MS_SYNC) == 0;
+}
+
+std::shared_ptr<MemoryPage> MappedFile::page(const std::shared_ptr<MappedFile> &file, size_t offset)
+{
+    // Share ownership of the mapping
+    return std::shared_ptr<MemoryPage>(file, reinterpret_cast<MemoryPage *>(file->bytes + offset));
+}
@@ -0,0 +1,201 @@
+#include "math_device.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+// Register offsets
+static constexpr uint8_t MATH_A = 0;
+static constexpr uint8_t MATH_B = 4;
+static constexpr uint8_t MATH_RESULT = 8;
+static constexpr uint8_t MATH_REMAINDER = 12;
+static constexpr uint8_t MATH_COMMAND = 14;
+static constexpr uint8_t MATH_STATUS = 15;
+
+static constexpr uint8_t STATUS_BUSY = 0x80;
+static constexpr uint8_t STATUS_DIVIDE_BY_ZERO = 0x01;
+
+// Reflected CRC-32 (IEEE 802.3), as used by zlib
+static const std::array<uint32_t, 256> &crc32_table()
+{
+    static const std::array<uint32_t, 256> table = []()
+    {
+        std::array<uint32_t, 256> entries;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                value = value & 1 ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+    return table;
+}
+
+static uint32_t load32(const uint8_t *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | uint32_t(bytes[3]) << 24;
+}
+
+static void store32(uint8_t *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        bytes[i] = value >> (8 * i);
+    }
+}
+
+MathDevice::MathDevice(const MathLatency &latency) : latency(latency) {}
+
+void MathDevice::connect(ByteCodeMemory *memory)
+{
+    bus = memory;
+}
+
+void MathDevice::write(uint16_t address, uint8_t value)
+{
+    uint8_t reg = address & 0xFF;
+    settle();
+    if (reg == MATH_COMMAND)
+    {
+        registers[reg] = value;
+        start(static_cast<MathCommand>(value));
+    }
+    else if (reg < MATH_RESULT)
+    {
+        registers[reg] = value;
+    }
+}
+
+uint8_t MathDevice::read(uint16_t address)
+{
+    uint8_t reg = address & 0xFF;
+    settle();
+    return reg < sizeof(registers) ? registers[reg] : 0;
+}
+
+void MathDevice::start(MathCommand command)
+{
+    uint32_t a = load32(registers + MATH_A);
+    uint16_t b = registers[MATH_B] | registers[MATH_B + 1] << 8;
+
+    uint32_t cycles;
+    pending_remainder = 0;
+    pending_status = 0;
+    switch (command)
+    {
+    case MathCommand::MULTIPLY:
+        pending_result = uint32_t(a & 0xFFFF) * b;
+        cycles = latency.multiply;
+        break;
+    case MathCommand::DIVIDE:
+        if (b == 0)
+        {
+            pending_result = 0xFFFFFFFF;
+            pending_remainder = a;
+            pending_status = STATUS_DIVIDE_BY_ZERO;
+        }
+        else
+        {
+            pending_result = a / b;
+            pending_remainder = a % b;
+        }
+        cycles = latency.divide;
+        break;
+    case MathCommand::CRC32:
+        pending_result = crc32(a, b);
+        cycles = latency.block_setup + uint32_t(b) * latency.per_byte;
+        break;
+    case MathCommand::CHECKSUM:
+        pending_result = fletcher16(a, b);
+        cycles = latency.block_setup + uint32_t(b) * latency.per_byte;
+        break;
+    default:
+        return;
+    }
+
+    busy = true;
+    ready_at = (bus ? bus->get_cycles() : 0) + cycles;
+    registers[MATH_STATUS] = STATUS_BUSY;
+    settle();
+}
+
+void MathDevice::settle()
+{
+    if (!busy || (bus && bus->get_cycles() < ready_at))
+    {
+        return;
+    }
+    busy = false;
+    store32(registers + MATH_RESULT, pending_result);
+    registers[MATH_REMAINDER] = pending_remainder & 0xFF;
+    registers[MATH_REMAINDER + 1] = pending_remainder >> 8;
+    registers[MATH_STATUS] = pending_status;
+}
+
+uint32_t MathDevice::crc32(uint16_t address, uint16_t size) const
+{
+    const std::array<uint32_t, 256> &table = crc32_table();
+    uint32_t crc = 0xFFFFFFFF;
+    while (bus && size > 0)
+    {
+        // Straight from the pages, like DMA
+        uint16_t chunk = std::min<uint32_t>(size, PAGE_SIZE - (address & 0xFF));
+        const uint8_t *bytes = bus->get_page(address >> 8) + (address & 0xFF);
+        for (uint16_t i = 0; i < chunk; i++)
+        {
+            crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+        }
+        address += chunk;
+        size -= chunk;
+    }
+    return ~crc;
+}
+
+uint16_t MathDevice::fletcher16(uint16_t address, uint16_t size) const
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    while (bus && size > 0)
+    {
+        uint16_t chunk = std::min<uint32_t>(size, PAGE_SIZE - (address & 0xFF));
+        const uint8_t *bytes = bus->get_page(address >> 8) + (address & 0xFF);
+        for (uint16_t i = 0; i < chunk; i++)
+        {
+            sum1 = (sum1 + bytes[i]) % 255;
+            sum2 = (sum2 + sum1) % 255;
+        }
+        address += chunk;
+        size -= chunk;
+    }
+    return sum2 << 8 | sum1;
+}
+
+void MathDevice::save_state(std::vector<uint8_t> &out) const
+{
+    out.insert(out.end(), registers, registers + sizeof(registers));
+    uint8_t pending[4 + 2 + 1 + 8 + 1];
+    store32(pending, pending_result);
+    memcpy(pending + 4, &pending_remainder, 2);
+    pending[6] = pending_status;
+    memcpy(pending + 7, &ready_at, 8);
+    pending[15] = busy;
+    out.insert(out.end(), pending, pending + sizeof(pending));
+}
+
+bool MathDevice::load_state(const uint8_t *data, size_t size)
+{
+    if (size != sizeof(registers) + 16)
+    {
+        return false;
+    }
+    memcpy(registers, data, sizeof(registers));
+    const uint8_t *pending = data + sizeof(registers);
+    pending_result = load32(pending);
+    memcpy(&pending_remainder, pending + 4, 2);
+    pending_status = pending[6];
+    memcpy(&ready_at, pending + 7, 8);
+    busy = pending[15];
+    return true;
+}
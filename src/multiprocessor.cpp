@@ -0,0 +1,150 @@
+#include "multiprocessor.h"
+#include "logging.h"
+#include <algorithm>
+#include <thread>
+
+SharedRegion::SharedRegion(size_t size) : bytes(new std::atomic<uint8_t>[size]), length(size)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        bytes[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint8_t SharedRegion::read(size_t offset) const
+{
+    return bytes[offset % length].load(std::memory_order_relaxed);
+}
+
+void SharedRegion::write(size_t offset, uint8_t value)
+{
+    bytes[offset % length].store(value, std::memory_order_relaxed);
+}
+
+size_t SharedRegion::size() const
+{
+    return length;
+}
+
+SharedWindowDevice::SharedWindowDevice(std::shared_ptr<SharedRegion> region, uint16_t base)
+    : region(std::move(region)), base(base) {}
+
+void SharedWindowDevice::write(uint16_t address, uint8_t value)
+{
+    region->write(static_cast<uint16_t>(address - base), value);
+}
+
+uint8_t SharedWindowDevice::read(uint16_t address)
+{
+    return region->read(static_cast<uint16_t>(address - base));
+}
+
+CycleBarrier::CycleBarrier(size_t count, std::function<void()> completion)
+    : count(count), completion(std::move(completion)) {}
+
+void CycleBarrier::arrive_and_wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t arrived_generation = generation;
+
+    if (++waiting == count)
+    {
+        completion();
+        waiting = 0;
+        generation++;
+        released.notify_all();
+        return;
+    }
+
+    released.wait(lock, [&]()
+                  { return generation != arrived_generation; });
+}
+
+Multiprocessor::Multiprocessor(uint64_t quantum) : quantum(std::max<uint64_t>(quantum, 1)) {}
+
+size_t Multiprocessor::add_core(std::unique_ptr<ExtendedMemory> memory, uint16_t entry)
+{
+    memories.push_back(memory.get());
+    cores.push_back(std::make_unique<Processor>(std::move(memory)));
+    cores.back()->reset();
+    cores.back()->set_PC(entry);
+    return cores.size() - 1;
+}
+
+Processor &Multiprocessor::core(size_t index)
+{
+    return *cores[index];
+}
+
+bool Multiprocessor::share(size_t index, std::shared_ptr<SharedRegion> region, uint16_t start)
+{
+    if (region->size() == 0 || start + region->size() > MEMORY_SIZE)
+    {
+        LOG_WARN("Shared region of " + std::to_string(region->size()) + " bytes does not fit at " + std::to_string(start) + ".");
+        return false;
+    }
+    uint16_t end = start + region->size() - 1;
+    memories[index]->attach(std::make_unique<SharedWindowDevice>(region, start), start, end);
+    return true;
+}
+
+uint64_t Multiprocessor::run(uint64_t max_cycles)
+{
+    // Each core counts cycles from its own starting point
+    std::vector<uint64_t> start_cycles;
+    for (auto &cpu : cores)
+    {
+        start_cycles.push_back(cpu->get_cycles());
+    }
+
+    std::vector<uint8_t> stopped(cores.size(), 0);
+    uint64_t elapsed = 0;
+    bool finished = false;
+
+    // Runs once per quantum on the last core to arrive, so every core sees the same decision
+    CycleBarrier barrier(cores.size(), [&]()
+                         {
+        elapsed = std::min(elapsed + quantum, max_cycles);
+        bool all_stopped = std::all_of(stopped.begin(), stopped.end(), [](uint8_t core_stopped)
+                                       { return core_stopped; });
+        finished = all_stopped || elapsed >= max_cycles; });
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < cores.size(); i++)
+    {
+        threads.emplace_back([&, i]()
+                             {
+            Processor &cpu = *cores[i];
+            uint64_t quantum_end = 0;
+
+            while (true)
+            {
+                quantum_end = std::min(quantum_end + quantum, max_cycles);
+                while (!stopped[i] && cpu.get_cycles() - start_cycles[i] < quantum_end)
+                {
+                    if (!cpu.step())
+                    {
+                        stopped[i] = 1;
+                    }
+                }
+
+                barrier.arrive_and_wait();
+                if (finished)
+                {
+                    break;
+                }
+            } });
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    uint64_t executed = 0;
+    for (size_t i = 0; i < cores.size(); i++)
+    {
+        executed = std::max(executed, cores[i]->get_cycles() - start_cycles[i]);
+    }
+    return executed;
+}
@@ -0,0 +1,49 @@
+#include "opcode_profile.h"
+#include <cstdio>
+
+OpcodeProfile::OpcodeProfile() : pairs(256 * 256, 0), history(0), previous{0, 0} {}
+
+void OpcodeProfile::record(OpCode opcode)
+{
+    uint8_t value = static_cast<uint8_t>(opcode);
+    if (history >= 1)
+    {
+        pairs[previous[1] << 8 | value]++;
+    }
+    if (history >= 2)
+    {
+        triples[previous[0] << 16 | previous[1] << 8 | value]++;
+    }
+
+    previous[0] = previous[1];
+    previous[1] = value;
+    if (history < 2)
+    {
+        history++;
+    }
+}
+
+void OpcodeProfile::break_sequence()
+{
+    history = 0;
+}
+
+void OpcodeProfile::write(std::ostream &out) const
+{
+    char line[64];
+    for (uint32_t index = 0; index < pairs.size(); index++)
+    {
+        if (pairs[index])
+        {
+            snprintf(line, sizeof(line), "2 %02X %02X %llu\n", index >> 8, index & 0xFF,
+                     static_cast<unsigned long long>(pairs[index]));
+            out << line;
+        }
+    }
+    for (const auto &triple : triples)
+    {
+        snprintf(line, sizeof(line), "3 %02X %02X %02X %llu\n", triple.first >> 16, (triple.first >> 8) & 0xFF,
+                 triple.first & 0xFF, static_cast<unsigned long long>(triple.second));
+        out << line;
+    }
+}
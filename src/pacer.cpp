@@ -0,0 +1,109 @@
+#include "pacer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+
+static int64_t monotonic_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_until_ns(int64_t deadline)
+{
+    timespec target;
+    target.tv_sec = deadline / 1000000000;
+    target.tv_nsec = deadline % 1000000000;
+    // Absolute sleeps do not accumulate error when interrupted and restarted. Other errors
+    // end the sleep early and the caller spins to the deadline.
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr) == EINTR)
+    {
+    }
+}
+
+Pacer::Pacer(double clock_hz, uint64_t slice_cycles, double spin_us, double resync_us)
+    : clock_hz(clock_hz), slice_cycles(std::max<uint64_t>(slice_cycles, 1)),
+      spin_ns(static_cast<int64_t>(spin_us * 1000)), resync_ns(static_cast<int64_t>(resync_us * 1000)) {}
+
+uint64_t Pacer::run(Processor &cpu, uint64_t max_cycles)
+{
+    stats = PacingStats();
+
+    uint64_t start_cycles = cpu.get_cycles();
+    // Cycle count and wall time the schedule is measured from, moved forward on resync
+    uint64_t epoch_cycles = start_cycles;
+    int64_t epoch_ns = monotonic_ns();
+    int64_t start_ns = epoch_ns;
+    int64_t dropped_ns = 0;
+
+    double sum = 0;
+    double sum_squares = 0;
+    bool running = true;
+
+    while (running && cpu.get_cycles() - start_cycles < max_cycles)
+    {
+        uint64_t target = std::min(cpu.get_cycles() + slice_cycles, start_cycles + max_cycles);
+        while (cpu.get_cycles() < target)
+        {
+            if (!cpu.step())
+            {
+                running = false;
+                break;
+            }
+        }
+
+        int64_t deadline = epoch_ns + static_cast<int64_t>((cpu.get_cycles() - epoch_cycles) * 1e9 / clock_hz);
+        int64_t now = monotonic_ns();
+
+        if (now > deadline)
+        {
+            stats.missed_deadlines++;
+        }
+        else
+        {
+            if (deadline - now > spin_ns)
+            {
+                sleep_until_ns(deadline - spin_ns);
+            }
+            while ((now = monotonic_ns()) < deadline)
+            {
+            }
+        }
+
+        // Counted before a resync, so the worst stalls show up in the figures
+        double lateness_us = (now - deadline) / 1000.0;
+        stats.slices++;
+        sum += lateness_us;
+        sum_squares += lateness_us * lateness_us;
+        stats.max_lateness_us = std::max(stats.max_lateness_us, lateness_us);
+
+        if (now - deadline > resync_ns)
+        {
+            // Too far behind to catch up without a burst, restart the schedule
+            stats.resyncs++;
+            dropped_ns += now - deadline;
+            epoch_cycles = cpu.get_cycles();
+            epoch_ns = now;
+        }
+    }
+
+    if (stats.slices)
+    {
+        stats.mean_lateness_us = sum / stats.slices;
+        stats.jitter_us = std::sqrt(std::max(0.0, sum_squares / stats.slices - stats.mean_lateness_us * stats.mean_lateness_us));
+    }
+
+    uint64_t executed = cpu.get_cycles() - start_cycles;
+    double emulated_ns = executed * 1e9 / clock_hz;
+    stats.drift_us = (monotonic_ns() - start_ns - dropped_ns - emulated_ns) / 1000.0;
+    stats.dropped_us = dropped_ns / 1000.0;
+
+    return executed;
+}
+
+const PacingStats &Pacer::get_stats() const
+{
+    return stats;
+}
@@ -0,0 +1,188 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+static const uint64_t COUNTER_CONFIGS[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static uint64_t rdpmc(uint32_t counter)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t low, high;
+    __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+    return uint64_t(high) << 32 | low;
+#else
+    return 0;
+#endif
+}
+#endif
+
+PerfCounters::PerfCounters() : leader(-1), fast_read(false)
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        fds[i] = -1;
+        pages[i] = nullptr;
+    }
+
+#ifdef __linux__
+    fast_read = true;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = COUNTER_CONFIGS[i];
+        attr.disabled = leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // Grouped so all counters cover the same interval
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fds[i] < 0)
+        {
+            error += std::string(error.empty() ? "" : "; ") + name(PerfCounter(i)) + ": " + strerror(errno);
+            continue;
+        }
+        if (leader < 0)
+        {
+            leader = fds[i];
+        }
+
+        void *page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fds[i], 0);
+        if (page == MAP_FAILED)
+        {
+            fast_read = false;
+            continue;
+        }
+        pages[i] = page;
+        fast_read = fast_read && static_cast<perf_event_mmap_page *>(page)->cap_user_rdpmc;
+    }
+    fast_read = fast_read && leader >= 0;
+#else
+    error = "perf_event_open is Linux only";
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        if (pages[i])
+        {
+            munmap(pages[i], sysconf(_SC_PAGESIZE));
+        }
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::is_available(PerfCounter counter) const
+{
+    return fds[counter] >= 0;
+}
+
+bool PerfCounters::any_available() const
+{
+    return leader >= 0;
+}
+
+const std::string &PerfCounters::get_error() const
+{
+    return error;
+}
+
+const char *PerfCounters::name(PerfCounter counter)
+{
+    static const char *NAMES[PERF_COUNTER_COUNT] = {"cycles", "instructions", "branch_misses", "cache_misses"};
+    return NAMES[counter];
+}
+
+void PerfCounters::start()
+{
+#ifdef __linux__
+    if (leader >= 0)
+    {
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+void PerfCounters::stop()
+{
+#ifdef __linux__
+    if (leader >= 0)
+    {
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+void PerfCounters::read(PerfSample &sample) const
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        sample.values[i] = fds[i] >= 0 ? read_counter(i) : 0;
+    }
+}
+
+bool PerfCounters::has_fast_read() const
+{
+    return fast_read;
+}
+
+uint64_t PerfCounters::read_counter(int counter) const
+{
+#ifdef __linux__
+    if (fast_read)
+    {
+        // The kernel updates the page under a sequence lock, see perf_event_mmap_page
+        const volatile perf_event_mmap_page *page = static_cast<const perf_event_mmap_page *>(pages[counter]);
+        uint32_t sequence;
+        uint64_t count;
+        do
+        {
+            sequence = page->lock;
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            uint32_t index = page->index;
+            count = page->offset;
+            if (index)
+            {
+                uint16_t width = page->pmc_width;
+                int64_t pmc = rdpmc(index - 1);
+                pmc <<= 64 - width;
+                pmc >>= 64 - width;
+                count += pmc;
+            }
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        } while (page->lock != sequence);
+        return count;
+    }
+
+    uint64_t count = 0;
+    if (::read(fds[counter], &count, sizeof(count)) != sizeof(count))
+    {
+        return 0;
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
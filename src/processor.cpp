@@ -1,7 +1,14 @@
-#include <iostream>
 #include "processor.h"
+#include "state_export.h"
+#include "input_log.h"
+#include "logging.h"
 
-Processor::Processor(std::unique_ptr<ByteCodeMemory> byte_code_memory) : memory(std::move(byte_code_memory)), A(0), X(0), Y(0), status(StatusFlag::UNUSED), PC(0), SP(0xFD) {}
+#include "processor_core.inc"
+
+Processor::Processor(std::unique_ptr<ByteCodeMemory> byte_code_memory) : memory(std::move(byte_code_memory)), A(0), X(0), Y(0), status(StatusFlag::UNUSED), PC(0), SP(0xFD), cycles(0), instructions(0), interrupts(0), halted(false), fault(Fault::NONE), coverage(nullptr), previous_location(0), exporter(nullptr), export_interval(0), next_export(UINT64_MAX)
+{
+    memory->attach_clock(&cycles);
+}
 
 Processor::~Processor()
 {
@@ -10,6 +17,8 @@ Processor::~Processor()
 void Processor::set_PC(uint16_t new_PC)
 {
     PC = new_PC;
+    halted = false;
+    fault = Fault::NONE;
 }
 
 OpCode Processor::fetch_opcode()
@@ -35,248 +44,115 @@ void Processor::reset()
 
     // Reset stack pointer to the top of the stack
     SP = 0xFD;
+
+    halted = false;
+    fault = Fault::NONE;
+    previous_location = 0;
+}
+
+bool Processor::step()
+{
+    NoHooks hooks;
+    return step(hooks);
+}
+
+uint64_t Processor::run(uint64_t max_steps)
+{
+    NoHooks hooks;
+    return run(max_steps, hooks);
+}
+
+uint64_t Processor::get_instructions() const
+{
+    return instructions;
+}
+
+bool Processor::is_halted() const
+{
+    return halted;
+}
+
+Fault Processor::get_fault() const
+{
+    return fault;
+}
+
+uint64_t Processor::get_cycles() const
+{
+    return cycles;
+}
+
+void Processor::set_cycles(uint64_t new_cycles)
+{
+    cycles = new_cycles;
+}
+
+uint64_t Processor::get_interrupts() const
+{
+    return interrupts;
+}
+
+Registers Processor::get_registers() const
+{
+    return {A, X, Y, status, PC, SP};
+}
+
+void Processor::set_registers(const Registers &registers)
+{
+    A = registers.A;
+    X = registers.X;
+    Y = registers.Y;
+    status = registers.status;
+    PC = registers.PC;
+    SP = registers.SP;
+
+    halted = false;
+    fault = Fault::NONE;
+    previous_location = 0;
+}
+
+void Processor::set_coverage_map(uint8_t *map)
+{
+    coverage = map;
+}
+
+void Processor::set_state_exporter(StateExporter *state_exporter, uint64_t interval)
+{
+    exporter = state_exporter;
+    export_interval = interval ? interval : 1;
+    next_export = exporter ? instructions : UINT64_MAX;
+}
+
+ByteCodeMemory &Processor::get_memory()
+{
+    return *memory;
+}
+
+void Processor::register_host_call(uint8_t id, HostCall call)
+{
+    if (host_calls.empty())
+    {
+        host_calls.resize(256);
+    }
+    host_calls[id] = std::move(call);
+}
+
+void Processor::install_host_call(uint16_t address, uint8_t id)
+{
+    memory->write(address, static_cast<uint8_t>(OpCode::HOST_CALL));
+    memory->write(address + 1, id);
+    memory->write(address + 2, static_cast<uint8_t>(OpCode::RTS));
 }
 
 void Processor::execute(OpCode opcode)
 {
-    switch (opcode)
+    NoHooks hooks;
+    dispatch(hooks, opcode);
+
+    // Callers stepping with fetch_opcode/execute retire instructions here
+    if (++instructions >= next_export)
     {
-    case OpCode::LDA_IMM:
-        LDA(immediate());
-        break;
-    case OpCode::LDX_IMM:
-        LDX(immediate());
-        break;
-    case OpCode::LDY_IMM:
-        LDY(immediate());
-        break;
-    case OpCode::STA_ZP:
-        STA(zero_page());
-        break;
-    case OpCode::STX_ZP:
-        STX(zero_page());
-        break;
-    case OpCode::STY_ZP:
-        STY(zero_page());
-        break;
-    case OpCode::LDA_ABS:
-        LDA(absolute());
-        break;
-    case OpCode::LDX_ABS:
-        LDX(absolute());
-        break;
-    case OpCode::LDY_ABS:
-        LDY(absolute());
-        break;
-    case OpCode::STA_ABS:
-        STA(absolute());
-        break;
-    case OpCode::STX_ABS:
-        STX(absolute());
-        break;
-    case OpCode::STY_ABS:
-        STY(absolute());
-        break;
-
-    case OpCode::TAX:
-        TAX();
-        break;
-    case OpCode::TAY:
-        TAY();
-        break;
-    case OpCode::TXA:
-        TXA();
-        break;
-    case OpCode::TYA:
-        TYA();
-        break;
-    case OpCode::TSX:
-        TSX();
-        break;
-    case OpCode::TXS:
-        TXS();
-        break;
-
-    case OpCode::PHA:
-        PHA();
-        break;
-    case OpCode::PHP:
-        PHP();
-        break;
-    case OpCode::PLA:
-        PLA();
-        break;
-    case OpCode::PLP:
-        PLP();
-        break;
-
-    case OpCode::AND_IMM:
-        AND(immediate());
-        break;
-    case OpCode::AND_ZP:
-        AND(zero_page());
-        break;
-    case OpCode::EOR_IMM:
-        EOR(immediate());
-        break;
-    case OpCode::EOR_ZP:
-        EOR(zero_page());
-        break;
-    case OpCode::ORA_IMM:
-        ORA(immediate());
-        break;
-    case OpCode::ORA_ZP:
-        ORA(zero_page());
-        break;
-    case OpCode::BIT_ZP:
-        BIT(zero_page());
-        break;
-
-    case OpCode::ADC_IMM:
-        ADC(immediate());
-        break;
-    case OpCode::ADC_ZP:
-        ADC(zero_page());
-        break;
-    case OpCode::SBC_IMM:
-        SBC(immediate());
-        break;
-    case OpCode::SBC_ZP:
-        SBC(zero_page());
-        break;
-    case OpCode::CMP_IMM:
-        CMP(immediate());
-        break;
-    case OpCode::CMP_ZP:
-        CMP(zero_page());
-        break;
-    case OpCode::CPX_IMM:
-        CPX(immediate());
-        break;
-    case OpCode::CPX_ZP:
-        CPX(zero_page());
-        break;
-    case OpCode::CPY_IMM:
-        CPY(immediate());
-        break;
-    case OpCode::CPY_ZP:
-        CPY(zero_page());
-        break;
-
-    case OpCode::INC_ZP:
-        INC(zero_page());
-        break;
-    case OpCode::INX:
-        INX();
-        break;
-    case OpCode::INY:
-        INY();
-        break;
-    case OpCode::DEC_ZP:
-        DEC(zero_page());
-        break;
-    case OpCode::DEX:
-        DEX();
-        break;
-    case OpCode::DEY:
-        DEY();
-        break;
-
-    case OpCode::ASL_ACC:
-        ASL(MEMORY_SIZE);
-        break;
-    case OpCode::ASL_ZP:
-        ASL(zero_page());
-        break;
-    case OpCode::LSR_ACC:
-        LSR(MEMORY_SIZE);
-        break;
-    case OpCode::LSR_ZP:
-        LSR(zero_page());
-        break;
-    case OpCode::ROL_ACC:
-        ROL(MEMORY_SIZE);
-        break;
-    case OpCode::ROL_ZP:
-        ROL(zero_page());
-        break;
-    case OpCode::ROR_ACC:
-        ROR(MEMORY_SIZE);
-        break;
-    case OpCode::ROR_ZP:
-        ROR(zero_page());
-        break;
-
-    case OpCode::JMP_ABS:
-        JMP(absolute());
-        break;
-    case OpCode::JSR_ABS:
-        JSR(absolute());
-        break;
-    case OpCode::RTS:
-        RTS();
-        break;
-
-    case OpCode::BPL:
-        branch_if(!(status & NEGATIVE));
-        break;
-    case OpCode::BMI:
-        branch_if(status & NEGATIVE);
-        break;
-    case OpCode::BVC:
-        branch_if(!(status & OVERFLOW));
-        break;
-    case OpCode::BVS:
-        branch_if(status & OVERFLOW);
-        break;
-    case OpCode::BCC:
-        branch_if(!(status & CARRY));
-        break;
-    case OpCode::BCS:
-        branch_if(status & CARRY);
-        break;
-    case OpCode::BNE:
-        branch_if(!(status & ZERO));
-        break;
-    case OpCode::BEQ:
-        branch_if(status & ZERO);
-        break;
-
-    case OpCode::CLC:
-        CLC();
-        break;
-    case OpCode::SEC:
-        SEC();
-        break;
-    case OpCode::CLI:
-        CLI();
-        break;
-    case OpCode::SEI:
-        SEI();
-        break;
-    case OpCode::CLV:
-        CLV();
-        break;
-    case OpCode::CLD:
-        CLD();
-        break;
-    case OpCode::SED:
-        SED();
-        break;
-
-    case OpCode::BRK:
-        BRK();
-        break;
-    case OpCode::NOP:
-        NOP();
-        break;
-    case OpCode::RTI:
-        RTI();
-        break;
-
-    default:
-        std::cout << "Unknown OPCODE: " << std::hex << static_cast<uint8_t>(opcode) << std::endl;
-        break;
+        export_state();
     }
 }
 
@@ -311,6 +187,32 @@ void Processor::update_zero_and_negative_flags(uint8_t value)
     set_flag(NEGATIVE, (value & 0x80) != 0);
 }
 
+void Processor::record_edge(uint16_t target)
+{
+    // AFL style: hash the destination and xor with the shifted previous location
+    uint16_t location = (target >> 4) ^ (target << 8);
+    coverage[(location ^ previous_location) % COVERAGE_MAP_SIZE]++;
+    previous_location = location >> 1;
+}
+
+void Processor::host_call(uint8_t id)
+{
+    if (id >= host_calls.size() || !host_calls[id])
+    {
+        fault = Fault::UNKNOWN_OPCODE;
+        LOG_WARN("Unregistered host call: " + std::to_string(id));
+        return;
+    }
+    // One instruction as far as stepping, profiles and exported counts are concerned
+    cycles += host_calls[id](*this);
+}
+
+void Processor::export_state()
+{
+    exporter->publish(*this);
+    next_export = instructions + export_interval;
+}
+
 uint8_t Processor::immediate()
 {
     return memory->read(PC++);
@@ -347,21 +249,6 @@ void Processor::LDY(uint8_t value)
     update_zero_and_negative_flags(Y);
 }
 
-void Processor::STA(uint16_t address)
-{
-    memory->write(address, A);
-}
-
-void Processor::STX(uint16_t address)
-{
-    memory->write(address, X);
-}
-
-void Processor::STY(uint16_t address)
-{
-    memory->write(address, Y);
-}
-
 // Register Transfers
 void Processor::TAX()
 {
@@ -399,32 +286,6 @@ void Processor::TXS()
     // TXS does not affect the processor status flags.
 }
 
-// Stack
-void Processor::PHA()
-{
-    memory->write(0x0100 + SP, A);
-    SP--;
-}
-
-void Processor::PHP()
-{
-    memory->write(0x0100 + SP, status);
-    SP--;
-}
-
-void Processor::PLA()
-{
-    SP++;
-    A = memory->read(0x0100 + SP);
-    update_zero_and_negative_flags(A);
-}
-
-void Processor::PLP()
-{
-    SP++;
-    status = memory->read(0x0100 + SP);
-}
-
 // Logical
 void Processor::AND(uint8_t value)
 {
@@ -554,14 +415,6 @@ void Processor::CPY(uint8_t value)
 }
 
 // Increments & Decrements
-void Processor::INC(uint16_t address)
-{
-    uint8_t value = memory->read(address);
-    value++;
-    memory->write(address, value);
-    update_zero_and_negative_flags(value);
-}
-
 void Processor::INX()
 {
     X++;
@@ -574,14 +427,6 @@ void Processor::INY()
     update_zero_and_negative_flags(Y);
 }
 
-void Processor::DEC(uint16_t address)
-{
-    uint8_t value = memory->read(address);
-    value--;
-    memory->write(address, value);
-    update_zero_and_negative_flags(value);
-}
-
 void Processor::DEX()
 {
     X--;
@@ -594,184 +439,6 @@ void Processor::DEY()
     update_zero_and_negative_flags(Y);
 }
 
-// Shifts
-void Processor::ASL(uint16_t address)
-{
-    uint8_t value = memory->read(address);
-    if (address == MEMORY_SIZE)
-    {
-        // Special address for accumulator
-        value = A;
-    }
-
-    // Clear the CARRY flag
-    status &= ~CARRY;
-    if (value & 0x80)
-    {
-        // Check if highest bit is set
-        status |= CARRY;
-    }
-
-    // Shift left by one bit
-    value <<= 1;
-    update_zero_and_negative_flags(value);
-
-    if (address == MEMORY_SIZE)
-    {
-        A = value;
-    }
-    else
-    {
-        memory->write(address, value);
-    }
-}
-
-void Processor::LSR(uint16_t address)
-{
-    uint8_t value = memory->read(address);
-    if (address == MEMORY_SIZE)
-    {
-        // Special address for accumulator
-        value = A;
-    }
-
-    status &= ~CARRY;
-    if (value & 0x01)
-    {
-        status |= CARRY;
-    }
-
-    // Shift right by one bit
-    value >>= 1;
-    update_zero_and_negative_flags(value);
-
-    if (address == MEMORY_SIZE)
-    {
-        A = value;
-    }
-    else
-    {
-        memory->write(address, value);
-    }
-}
-
-void Processor::ROL(uint16_t address)
-{
-    uint8_t value = memory->read(address);
-    if (address == MEMORY_SIZE)
-    {
-        value = A;
-    }
-
-    // Store the current high bit
-    uint8_t new_carry = (value & 0x80) ? 1 : 0;
-    value <<= 1;
-    if (status & CARRY)
-    {
-        // Set the low bit if CARRY was set
-        value |= 0x01;
-    }
-
-    status &= ~CARRY;
-    if (new_carry)
-    {
-        status |= CARRY;
-    }
-
-    update_zero_and_negative_flags(value);
-
-    if (address == MEMORY_SIZE)
-    {
-        A = value;
-    }
-    else
-    {
-        memory->write(address, value);
-    }
-}
-
-void Processor::ROR(uint16_t address)
-{
-    uint8_t value = memory->read(address);
-    if (address == MEMORY_SIZE)
-    {
-        value = A;
-    }
-
-    // Store the current low bit
-    uint8_t new_carry = value & 0x01;
-    value >>= 1;
-    if (status & CARRY)
-    {
-        // Set the high bit if CARRY was set
-        value |= 0x80;
-    }
-
-    status &= ~CARRY;
-    if (new_carry)
-    {
-        status |= CARRY;
-    }
-
-    update_zero_and_negative_flags(value);
-
-    if (address == MEMORY_SIZE)
-    {
-        A = value;
-    }
-    else
-    {
-        memory->write(address, value);
-    }
-}
-
-// Jumps & Calls
-void Processor::JMP(uint16_t address)
-{
-    PC = address;
-}
-
-void Processor::JSR(uint16_t address)
-{
-    // Push the return address - 1 onto the stack.
-    // The -1 is because when returning with RTS, the PC is incremented after fetching the address
-    uint16_t return_address = PC - 1;
-    // Push high byte
-    memory->write(0x0100 + SP, return_address >> 8);
-    SP--;
-    // Push low byte
-    memory->write(0x0100 + SP, return_address & 0xFF);
-    SP--;
-
-    // Jump to subroutine
-    PC = address;
-}
-
-void Processor::RTS()
-{
-    SP++;
-    uint8_t low_byte = memory->read(0x0100 + SP);
-    SP++;
-    uint8_t high_byte = memory->read(0x0100 + SP);
-
-    PC = (high_byte << 8) | low_byte;
-    // Increment PC because the saved address was -1 from the actual return address
-    PC++;
-}
-
-// Branches
-void Processor::branch_if(bool condition)
-{
-    // Read signed byte
-    int8_t offset = static_cast<int8_t>(memory->read(PC++));
-
-    if (condition)
-    {
-        // If branch is taken, adjust the program counter by the offset.
-        PC += offset;
-    }
-}
-
 // Status Flag Changes
 void Processor::CLC()
 {
@@ -809,43 +476,12 @@ void Processor::SED()
 }
 
 // System Functions
-void Processor::BRK()
-{
-    // Increment PC to skip the padding byte after the BRK opcode.
-    PC++;
-
-    // Push the program counter and status onto the stack.
-    memory->write(0x0100 + SP, (PC >> 8) & 0xFF);
-    SP--;
-    memory->write(0x0100 + SP, PC & 0xFF);
-    SP--;
-
-    // Set the Break flag.
-    uint8_t statusWithBreak = status | BREAK;
-    memory->write(0x0100 + SP, statusWithBreak);
-    SP--;
-
-    // Load interrupt vector and jump to the interrupt routine.
-    uint8_t low_byte = memory->read(0xFFFE);
-    uint8_t high_byte = memory->read(0xFFFF);
-    PC = (high_byte << 8) | low_byte;
-}
-
 void Processor::NOP()
 {
     // Do nothing.
 }
 
-void Processor::RTI()
-{
-    // Pull the processor status from the stack.
-    SP++;
-    status = memory->read(0x0100 + SP);
-
-    // Pull the program counter from the stack.
-    SP++;
-    uint8_t low_byte = memory->read(0x0100 + SP);
-    SP++;
-    uint8_t high_byte = memory->read(0x0100 + SP);
-    PC = (high_byte << 8) | low_byte;
-}
\ No newline at end of file
+// The other policies are instantiated in processor_hooks.cpp, so they do not change how
+// this one is inlined
+template bool Processor::step(NoHooks &);
+template uint64_t Processor::run(uint64_t, NoHooks &);
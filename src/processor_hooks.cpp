@@ -0,0 +1,189 @@
+#include "processor_hooks.h"
+#include "input_log.h"
+#include "logging.h"
+#include "processor_core.inc"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+TraceHooks::TraceHooks(std::ostream &out) : out(out), open_line(false) {}
+
+TraceHooks::~TraceHooks()
+{
+    end_line();
+}
+
+void TraceHooks::on_fetch(uint16_t address, OpCode opcode)
+{
+    // BRK is fetched but never dispatched, so it ends no line itself
+    end_line();
+    char text[16];
+    snprintf(text, sizeof(text), "%04X %02X", address, static_cast<uint8_t>(opcode));
+    out << text;
+    open_line = true;
+}
+
+void TraceHooks::on_read(uint16_t address, uint8_t value)
+{
+    char text[16];
+    snprintf(text, sizeof(text), " r%04X=%02X", address, value);
+    out << text;
+}
+
+void TraceHooks::on_write(uint16_t address, uint8_t value)
+{
+    char text[16];
+    snprintf(text, sizeof(text), " w%04X=%02X", address, value);
+    out << text;
+}
+
+void TraceHooks::on_cycle(uint64_t cycles)
+{
+    out << " c=" << cycles << '\n';
+    open_line = false;
+}
+
+void TraceHooks::end_line()
+{
+    if (open_line)
+    {
+        out << '\n';
+        open_line = false;
+    }
+}
+
+WatchHooks::WatchHooks(uint16_t start, uint16_t end) : start(start), end(end), instruction(0), hits(0) {}
+
+void WatchHooks::hit(uint16_t address, uint8_t value, bool write)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "Watch: 0x%04X %s 0x%02X %s 0x%04X", instruction, write ? "wrote" : "read",
+             value, write ? "to" : "from", address);
+    LOG_INFO(text);
+    hits++;
+}
+
+uint64_t WatchHooks::get_hits() const
+{
+    return hits;
+}
+
+// One runner per policy, owning its hooks
+class NoHooksRunner : public HookedRunner
+{
+public:
+    uint64_t run(Processor &cpu, uint64_t max_steps) override
+    {
+        return cpu.run(max_steps, hooks);
+    }
+    std::string summary() const override
+    {
+        return "No hooks.";
+    }
+
+private:
+    NoHooks hooks;
+};
+
+class CountingRunner : public HookedRunner
+{
+public:
+    uint64_t run(Processor &cpu, uint64_t max_steps) override
+    {
+        return cpu.run(max_steps, hooks);
+    }
+    std::string summary() const override
+    {
+        return "Fetches: " + std::to_string(hooks.fetches) + ", reads: " + std::to_string(hooks.reads) +
+               ", writes: " + std::to_string(hooks.writes) + ", branches: " + std::to_string(hooks.branches) +
+               " (" + std::to_string(hooks.taken_branches) + " taken).";
+    }
+
+private:
+    CountingHooks hooks;
+};
+
+class TraceRunner : public HookedRunner
+{
+public:
+    TraceRunner(std::unique_ptr<std::ofstream> file) : file(std::move(file)), hooks(this->file ? *this->file : std::cerr) {}
+    uint64_t run(Processor &cpu, uint64_t max_steps) override
+    {
+        return cpu.run(max_steps, hooks);
+    }
+    std::string summary() const override
+    {
+        return "Traced to " + std::string(file ? "file." : "stderr.");
+    }
+
+private:
+    std::unique_ptr<std::ofstream> file;
+    TraceHooks hooks;
+};
+
+class WatchRunner : public HookedRunner
+{
+public:
+    WatchRunner(uint16_t start, uint16_t end) : hooks(start, end) {}
+    uint64_t run(Processor &cpu, uint64_t max_steps) override
+    {
+        return cpu.run(max_steps, hooks);
+    }
+    std::string summary() const override
+    {
+        return "Watched range accessed " + std::to_string(hooks.get_hits()) + " times.";
+    }
+
+private:
+    WatchHooks hooks;
+};
+
+std::unique_ptr<HookedRunner> make_hooked_runner(const std::string &spec)
+{
+    std::string policy = spec.substr(0, spec.find('='));
+    std::string argument = spec.find('=') == std::string::npos ? "" : spec.substr(spec.find('=') + 1);
+
+    if (policy == "none" && argument.empty())
+    {
+        return std::make_unique<NoHooksRunner>();
+    }
+    if (policy == "count" && argument.empty())
+    {
+        return std::make_unique<CountingRunner>();
+    }
+    if (policy == "trace")
+    {
+        std::unique_ptr<std::ofstream> file;
+        if (!argument.empty())
+        {
+            file = std::make_unique<std::ofstream>(argument);
+            if (!*file)
+            {
+                LOG_WARN("Cannot open trace file " + argument);
+                return nullptr;
+            }
+        }
+        return std::make_unique<TraceRunner>(std::move(file));
+    }
+
+    unsigned start, end;
+    char separator;
+    if (policy == "watch" && sscanf(argument.c_str(), "%x%c%x", &start, &separator, &end) == 3 && separator == '-' &&
+        start <= end && end <= 0xFFFF)
+    {
+        return std::make_unique<WatchRunner>(start, end);
+    }
+
+    LOG_WARN("Unknown hooks policy: " + spec);
+    return nullptr;
+}
+
+// Each policy is its own copy of the interpreter, compiled here apart from the plain one
+template bool Processor::step(CountingHooks &);
+template uint64_t Processor::run(uint64_t, CountingHooks &);
+template bool Processor::step(TraceHooks &);
+template uint64_t Processor::run(uint64_t, TraceHooks &);
+template bool Processor::step(WatchHooks &);
+template uint64_t Processor::run(uint64_t, WatchHooks &);
+template bool Processor::step(ProfileHooks &);
+template uint64_t Processor::run(uint64_t, ProfileHooks &);
@@ -0,0 +1,159 @@
+#include "recorder.h"
+#include <algorithm>
+
+Recorder::Recorder(Processor &cpu, uint64_t keyframe_interval)
+    : cpu(cpu), keyframe_interval(keyframe_interval), recorded_until(cpu.get_cycles())
+{
+    cpu.get_memory().set_input_log(&log);
+    take_keyframe();
+}
+
+Recorder::~Recorder()
+{
+    cpu.get_memory().set_input_log(nullptr);
+}
+
+bool Recorder::step()
+{
+    if (log.is_replaying() && cpu.get_cycles() >= recorded_until)
+    {
+        // Caught up with the recording, inputs are live again and the devices continue
+        // from where recording left them
+        log.set_replaying(false);
+        cpu.get_memory().load_device_state(live_device_state.data(), live_device_state.size());
+    }
+
+    if (!log.is_replaying() && cpu.get_cycles() >= keyframes.back().cycles + keyframe_interval)
+    {
+        take_keyframe();
+    }
+
+    bool running = cpu.step();
+    if (!log.is_replaying())
+    {
+        recorded_until = cpu.get_cycles();
+    }
+    return running;
+}
+
+uint64_t Recorder::run(uint64_t max_steps)
+{
+    uint64_t steps = 0;
+    while (steps < max_steps)
+    {
+        steps++;
+        if (!step())
+        {
+            break;
+        }
+    }
+    return steps;
+}
+
+bool Recorder::seek(uint64_t cycle)
+{
+    if (cycle > recorded_until)
+    {
+        return false;
+    }
+
+    leave_live();
+    restore_keyframe(keyframe_before(cycle));
+    log.set_replaying(true);
+
+    while (cpu.get_cycles() < cycle)
+    {
+        if (!cpu.step())
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+bool Recorder::step_back()
+{
+    uint64_t now = cpu.get_cycles();
+    if (now <= keyframes.front().cycles)
+    {
+        return false;
+    }
+
+    // Replay from the keyframe to find where the instruction ending at `now` started
+    leave_live();
+    restore_keyframe(keyframe_before(now - 1));
+    log.set_replaying(true);
+
+    uint64_t previous = cpu.get_cycles();
+    while (cpu.get_cycles() < now)
+    {
+        previous = cpu.get_cycles();
+        if (!cpu.step())
+        {
+            break;
+        }
+    }
+
+    return seek(previous);
+}
+
+uint64_t Recorder::host_value(uint64_t live)
+{
+    return log.host_value(live);
+}
+
+uint64_t Recorder::get_recorded_cycles() const
+{
+    return recorded_until;
+}
+
+size_t Recorder::get_keyframe_count() const
+{
+    return keyframes.size();
+}
+
+const InputLog &Recorder::get_log() const
+{
+    return log;
+}
+
+void Recorder::leave_live()
+{
+    if (!log.is_replaying())
+    {
+        live_device_state.clear();
+        cpu.get_memory().save_device_state(live_device_state);
+    }
+}
+
+void Recorder::take_keyframe()
+{
+    ByteCodeMemory &memory = cpu.get_memory();
+
+    Keyframe keyframe;
+    keyframe.cycles = cpu.get_cycles();
+    keyframe.registers = cpu.get_registers();
+    keyframe.memory = memory.snapshot();
+    memory.save_device_state(keyframe.device_state);
+    keyframe.log_position = log.get_position();
+    keyframes.push_back(std::move(keyframe));
+}
+
+void Recorder::restore_keyframe(const Keyframe &keyframe)
+{
+    ByteCodeMemory &memory = cpu.get_memory();
+
+    memory.restore(keyframe.memory);
+    memory.load_device_state(keyframe.device_state.data(), keyframe.device_state.size());
+    cpu.set_registers(keyframe.registers);
+    cpu.set_cycles(keyframe.cycles);
+    log.seek(keyframe.log_position);
+}
+
+const Recorder::Keyframe &Recorder::keyframe_before(uint64_t cycle) const
+{
+    // Keyframes are ordered by cycle, the first one is the start of the recording
+    auto after = std::upper_bound(keyframes.begin(), keyframes.end(), cycle, [](uint64_t c, const Keyframe &keyframe)
+                                  { return c < keyframe.cycles; });
+    return after == keyframes.begin() ? keyframes.front() : *(after - 1);
+}
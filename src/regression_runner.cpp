@@ -0,0 +1,316 @@
+#include "regression_runner.h"
+#include "assembler.h"
+#include "device.h"
+#include "dma_device.h"
+#include "math_device.h"
+#include "processor.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+struct RegressionJob
+{
+    std::string name;
+    std::vector<uint8_t> program;
+    // Set when the program could not be loaded, the job fails without running
+    std::string error;
+    bool has_output = false;
+    std::string expected_output;
+    std::string expected_registers;
+};
+
+static bool read_file(const fs::path &path, std::string &contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool load_corpus(const std::string &directory, std::vector<RegressionJob> &jobs, std::error_code &error)
+{
+    fs::directory_iterator end;
+    for (fs::directory_iterator entry(directory, error); !error && entry != end; entry.increment(error))
+    {
+        const fs::path &path = entry->path();
+        if (path.extension() != ".asm" && path.extension() != ".bin")
+        {
+            continue;
+        }
+
+        RegressionJob job;
+        job.name = path.stem().string();
+
+        if (path.extension() == ".asm")
+        {
+            Assembly assembly;
+            if (!assemble(path.string(), PROGRAM_ORIGIN, assembly))
+            {
+                job.error = "assembly failed";
+            }
+            job.program = std::move(assembly.byte_code);
+        }
+        else
+        {
+            std::string bytes;
+            if (!read_file(path, bytes))
+            {
+                job.error = "unreadable program";
+            }
+            job.program.assign(bytes.begin(), bytes.end());
+        }
+
+        fs::path golden = path;
+        job.has_output = read_file(golden.replace_extension(".out"), job.expected_output);
+        read_file(golden.replace_extension(".regs"), job.expected_registers);
+
+        jobs.push_back(std::move(job));
+    }
+
+    std::sort(jobs.begin(), jobs.end(), [](const RegressionJob &a, const RegressionJob &b)
+              { return a.name < b.name; });
+    return !error;
+}
+
+static std::string hex(unsigned value)
+{
+    std::ostringstream ss;
+    ss << std::uppercase << std::hex << value;
+    return ss.str();
+}
+
+static std::string compare_registers(const std::string &expected, const Registers &actual)
+{
+    std::istringstream iss(expected);
+    std::string token;
+    while (iss >> token)
+    {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos)
+        {
+            return "malformed register entry '" + token + "'";
+        }
+
+        std::string name = token.substr(0, equals);
+        std::string text = token.substr(equals + 1);
+        size_t parsed = 0;
+        unsigned value;
+        try
+        {
+            value = std::stoul(text, &parsed, 16);
+        }
+        catch (const std::exception &)
+        {
+            parsed = 0;
+        }
+        if (parsed == 0 || parsed != text.size())
+        {
+            return "malformed register value '" + token + "'";
+        }
+        unsigned got;
+
+        if (name == "A")
+            got = actual.A;
+        else if (name == "X")
+            got = actual.X;
+        else if (name == "Y")
+            got = actual.Y;
+        else if (name == "SP")
+            got = actual.SP;
+        else if (name == "P")
+            got = actual.status;
+        else if (name == "PC")
+            got = actual.PC;
+        else
+            return "unknown register '" + name + "'";
+
+        if (got != value)
+        {
+            return "register " + name + " expected " + hex(value) + " got " + hex(got);
+        }
+    }
+    return "";
+}
+
+static std::string describe_fault(Fault fault)
+{
+    switch (fault)
+    {
+    case Fault::UNKNOWN_OPCODE:
+        return "unknown opcode";
+    case Fault::STACK_OVERFLOW:
+        return "stack overflow";
+    case Fault::STACK_UNDERFLOW:
+        return "stack underflow";
+    case Fault::NONE:
+        break;
+    }
+    return "no fault";
+}
+
+static RegressionResult run_job(const RegressionJob &job, uint64_t max_steps)
+{
+    RegressionResult result;
+    result.name = job.name;
+
+    if (!job.error.empty())
+    {
+        result.message = job.error;
+        return result;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::string output;
+    auto memory = std::make_unique<ExtendedMemory>(std::make_unique<CharacterDisplayDevice>());
+    memory->attach(std::make_unique<DmaDevice>(), DMA_BASE, DMA_BASE + 0xFF);
+    memory->attach(std::make_unique<MathDevice>(), MATH_BASE, MATH_BASE + 0xFF);
+    memory->set_output(&output);
+    memory->load_shared(0x8000, job.program.data(), job.program.size());
+
+    Processor cpu(std::move(memory));
+    cpu.reset();
+    cpu.set_PC(0x8000);
+    result.steps = cpu.run(max_steps);
+
+    Registers registers = cpu.get_registers();
+
+    if (cpu.get_fault() != Fault::NONE)
+    {
+        result.message = describe_fault(cpu.get_fault()) + " (PC=" + hex(registers.PC) + ")";
+    }
+    else if (!cpu.is_halted())
+    {
+        result.message = "instruction budget of " + std::to_string(max_steps) + " exhausted";
+    }
+    else if (job.has_output && output != job.expected_output)
+    {
+        auto mismatch = std::mismatch(output.begin(), output.end(), job.expected_output.begin(), job.expected_output.end());
+        result.message = "output differs at byte " + std::to_string(mismatch.first - output.begin()) +
+                         " (expected " + std::to_string(job.expected_output.size()) +
+                         " bytes, got " + std::to_string(output.size()) + ")";
+    }
+    else
+    {
+        result.message = compare_registers(job.expected_registers, registers);
+    }
+    result.passed = result.message.empty();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+    return result;
+}
+
+std::vector<RegressionResult> run_regressions(const RegressionOptions &options, double *seconds)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<RegressionJob> jobs;
+    std::error_code error;
+    if (!load_corpus(options.directory, jobs, error))
+    {
+        // Reported as a failed test so the run fails like any other
+        RegressionResult result;
+        result.name = options.directory;
+        result.message = "cannot read corpus: " + error.message();
+        return {result};
+    }
+    std::vector<RegressionResult> results(jobs.size());
+
+    unsigned workers = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min<unsigned>(workers, std::max<size_t>(jobs.size(), 1));
+
+    // Workers pull the next job index until the corpus is exhausted
+    std::atomic<size_t> next_job{0};
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w < workers; w++)
+    {
+        threads.emplace_back([&]()
+                             {
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++)
+            {
+                results[i] = run_job(jobs[i], options.max_steps);
+            } });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    if (seconds)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        *seconds = elapsed.count();
+    }
+    return results;
+}
+
+static std::string escape(const std::string &text, ReportFormat format)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (format == ReportFormat::JSON && (c == '"' || c == '\\'))
+            escaped += std::string("\\") + c;
+        else if (format == ReportFormat::JUNIT && c == '&')
+            escaped += "&amp;";
+        else if (format == ReportFormat::JUNIT && c == '<')
+            escaped += "&lt;";
+        else if (format == ReportFormat::JUNIT && c == '>')
+            escaped += "&gt;";
+        else if (format == ReportFormat::JUNIT && c == '"')
+            escaped += "&quot;";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+void write_report(std::ostream &out, const std::vector<RegressionResult> &results, double total_seconds, ReportFormat format)
+{
+    size_t failures = std::count_if(results.begin(), results.end(), [](const RegressionResult &r)
+                                    { return !r.passed; });
+
+    if (format == ReportFormat::JSON)
+    {
+        out << "{\"tests\": " << results.size() << ", \"failures\": " << failures
+            << ", \"seconds\": " << total_seconds << ", \"results\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const RegressionResult &result = results[i];
+            out << (i ? ", " : "") << "{\"name\": \"" << escape(result.name, format) << "\""
+                << ", \"passed\": " << (result.passed ? "true" : "false")
+                << ", \"steps\": " << result.steps
+                << ", \"seconds\": " << result.seconds
+                << ", \"message\": \"" << escape(result.message, format) << "\"}";
+        }
+        out << "]}" << std::endl;
+        return;
+    }
+
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<testsuite name=\"emu6502\" tests=\"" << results.size() << "\" failures=\"" << failures
+        << "\" time=\"" << total_seconds << "\">\n";
+    for (const RegressionResult &result : results)
+    {
+        out << "  <testcase name=\"" << escape(result.name, format) << "\" time=\"" << result.seconds << "\"";
+        if (result.passed)
+        {
+            out << "/>\n";
+            continue;
+        }
+        out << ">\n    <failure message=\"" << escape(result.message, format) << "\"/>\n  </testcase>\n";
+    }
+    out << "</testsuite>" << std::endl;
+}
@@ -0,0 +1,287 @@
+#include "result_cache.h"
+#include "build_id.h"
+#include "logging.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unistd.h>
+
+struct CacheFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t build_id;
+    uint64_t count;
+};
+
+static constexpr char CACHE_FILE_MAGIC[4] = {'E', '6', '5', 'M'};
+
+static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+
+// Bytes per stripe, one 64 bit word per lane
+static constexpr size_t STRIPE_SIZE = 32;
+
+static uint64_t rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// xxHash64 style rounds over four independent lanes. No lane depends on another, so the
+// stripe loop vectorizes and a 64 KB image hashes in microseconds, far below any run; FNV-1a
+// as used by PageCache would take a dependent multiply per byte.
+class StripeHasher
+{
+public:
+    StripeHasher(uint64_t seed) : lanes{seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1}, length(0), buffered(0) {}
+
+    void update(const void *data, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        length += size;
+
+        if (buffered)
+        {
+            size_t part = std::min(size, STRIPE_SIZE - buffered);
+            memcpy(buffer + buffered, bytes, part);
+            buffered += part;
+            bytes += part;
+            size -= part;
+            if (buffered < STRIPE_SIZE)
+            {
+                return;
+            }
+            round(buffer);
+            buffered = 0;
+        }
+
+        for (; size >= STRIPE_SIZE; bytes += STRIPE_SIZE, size -= STRIPE_SIZE)
+        {
+            round(bytes);
+        }
+        memcpy(buffer, bytes, size);
+        buffered = size;
+    }
+
+    // Two differently mixed 64 bit halves of the lanes and the length
+    ResultKey finish()
+    {
+        if (buffered)
+        {
+            memset(buffer + buffered, 0, STRIPE_SIZE - buffered);
+            round(buffer);
+        }
+        uint64_t low = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+        uint64_t high = (lanes[0] ^ rotate(lanes[2], 29)) + (lanes[1] ^ rotate(lanes[3], 37)) * PRIME3;
+        return {avalanche(low ^ length * PRIME1), avalanche(high + length)};
+    }
+
+private:
+    void round(const uint8_t *stripe)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t word;
+            memcpy(&word, stripe + lane * 8, sizeof(word));
+            lanes[lane] = rotate(lanes[lane] + word * PRIME2, 31) * PRIME1;
+        }
+    }
+
+    uint64_t lanes[4];
+    uint64_t length;
+    uint8_t buffer[STRIPE_SIZE];
+    size_t buffered;
+};
+
+ResultCache::ResultCache(size_t capacity) : capacity(capacity), size(0), hits(0), misses(0), evictions(0) {}
+
+ResultKey ResultCache::key(const JobRequestHeader &request, const uint8_t *image, const uint8_t *input)
+{
+    // timeout_ms is left out: timed out results are not stored, and any other result is
+    // the same whatever the timeout
+    StripeHasher hasher(EMU6502_BUILD_ID + RESULT_CACHE_VERSION);
+    hasher.update(&request.load_address, sizeof(request.load_address));
+    hasher.update(&request.entry, sizeof(request.entry));
+    hasher.update(&request.max_cycles, sizeof(request.max_cycles));
+    hasher.update(&request.image_size, sizeof(request.image_size));
+    hasher.update(&request.input_size, sizeof(request.input_size));
+    hasher.update(image, request.image_size);
+    hasher.update(input, request.input_size);
+    return hasher.finish();
+}
+
+bool ResultCache::lookup(const ResultKey &key, JobResponseHeader &response, std::string &output)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = index.find(key);
+    if (found == index.end())
+    {
+        misses++;
+        return false;
+    }
+
+    entries.splice(entries.begin(), entries, found->second);
+    response = found->second->response;
+    output = found->second->output;
+    hits++;
+    return true;
+}
+
+void ResultCache::insert(const ResultKey &key, const JobResponseHeader &response, const std::string &output)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    insert_locked(key, response, output);
+}
+
+void ResultCache::insert_locked(const ResultKey &key, const JobResponseHeader &response, const std::string &output)
+{
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        // A concurrent miss of the same job stored it first
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+
+    Entry entry = {key, response, output};
+    if (footprint(entry) > capacity)
+    {
+        return;
+    }
+    size += footprint(entry);
+    entries.push_front(std::move(entry));
+    index[key] = entries.begin();
+
+    while (size > capacity)
+    {
+        size -= footprint(entries.back());
+        index.erase(entries.back().key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+size_t ResultCache::footprint(const Entry &entry)
+{
+    // The list node and index slot are counted roughly
+    return sizeof(Entry) + entry.output.size() + 4 * sizeof(void *);
+}
+
+bool ResultCache::load(const std::string &path)
+{
+    if (access(path.c_str(), F_OK) != 0)
+    {
+        return true;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    CacheFileHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != RESULT_CACHE_VERSION ||
+        header.build_id != EMU6502_BUILD_ID)
+    {
+        LOG_WARN("Ignoring result cache " + path + " from another build.");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint64_t i = 0; i < header.count; i++)
+    {
+        ResultKey key;
+        JobResponseHeader response;
+        uint32_t output_size;
+        if (!file.read(reinterpret_cast<char *>(&key), sizeof(key)) ||
+            !file.read(reinterpret_cast<char *>(&response), sizeof(response)) ||
+            !file.read(reinterpret_cast<char *>(&output_size), sizeof(output_size)))
+        {
+            LOG_WARN("Result cache " + path + " is truncated.");
+            return false;
+        }
+        // Entries past the budget are never stored, a larger size means a corrupt file
+        if (output_size > capacity)
+        {
+            LOG_WARN("Result cache " + path + " is corrupt.");
+            return false;
+        }
+        std::string output(output_size, '\0');
+        if (!file.read(&output[0], output_size))
+        {
+            LOG_WARN("Result cache " + path + " is truncated.");
+            return false;
+        }
+        insert_locked(key, response, output);
+    }
+    return true;
+}
+
+bool ResultCache::save(const std::string &path) const
+{
+    std::string contents;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        CacheFileHeader header = {};
+        memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+        header.version = RESULT_CACHE_VERSION;
+        header.build_id = EMU6502_BUILD_ID;
+        header.count = entries.size();
+        contents.append(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+        {
+            uint32_t output_size = entry->output.size();
+            contents.append(reinterpret_cast<const char *>(&entry->key), sizeof(entry->key));
+            contents.append(reinterpret_cast<const char *>(&entry->response), sizeof(entry->response));
+            contents.append(reinterpret_cast<const char *>(&output_size), sizeof(output_size));
+            contents.append(entry->output);
+        }
+    }
+
+    // Readers of a half written file would throw the whole cache away
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temporary.c_str(), "wb");
+    bool ok = file && fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    ok = file && fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        LOG_WARN("Could not save the result cache to " + path);
+        return false;
+    }
+    return true;
+}
+
+uint64_t ResultCache::get_hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+uint64_t ResultCache::get_misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+uint64_t ResultCache::get_evictions() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return evictions;
+}
+
+size_t ResultCache::get_size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return size;
+}
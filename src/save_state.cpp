@@ -0,0 +1,224 @@
+#include "save_state.h"
+#include "logging.h"
+#include "mapped_file.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+struct SegmentHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t page_count;
+    uint32_t device_state_size;
+    uint64_t cycles;
+    uint16_t PC;
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t status;
+    uint8_t SP;
+    uint8_t reserved;
+};
+
+static constexpr char SEGMENT_MAGIC[4] = {'E', '6', '5', 'S'};
+
+// Page indices follow the header, page data starts at the next PAGE_SIZE boundary of the file
+static size_t align_to_page(size_t offset)
+{
+    return (offset + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, bytes, size);
+        if (written < 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+SaveStateWriter::SaveStateWriter(const std::string &path, bool append) : path(path), append(append)
+{
+    // Nothing to extend yet, the first save has to be complete
+    if (append && access(path.c_str(), F_OK) != 0)
+    {
+        this->append = false;
+    }
+}
+
+bool SaveStateWriter::save(Processor &cpu)
+{
+    ByteCodeMemory &memory = cpu.get_memory();
+
+    std::vector<uint16_t> indices;
+    std::bitset<PAGE_COUNT> dirty = memory.dirty_pages();
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        // Banked pages belong to their device
+        if (!memory.is_external(page) && (append ? dirty[page] : !memory.is_zero_page(page)))
+        {
+            indices.push_back(page);
+        }
+    }
+
+    std::vector<uint8_t> device_state;
+    memory.save_device_state(device_state);
+
+    Registers registers = cpu.get_registers();
+    SegmentHeader header = {};
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = SAVE_STATE_VERSION;
+    header.page_count = indices.size();
+    header.device_state_size = device_state.size();
+    header.cycles = cpu.get_cycles();
+    header.PC = registers.PC;
+    header.A = registers.A;
+    header.X = registers.X;
+    header.Y = registers.Y;
+    header.status = registers.status;
+    header.SP = registers.SP;
+
+    std::string target = append ? path : path + ".tmp";
+    int fd = open(target.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0)
+    {
+        LOG_WARN("Could not open save state " + target);
+        return false;
+    }
+
+    struct stat info;
+    fstat(fd, &info);
+    size_t offset = info.st_size;
+
+    // Segments start page aligned so page data inside them stays aligned
+    std::vector<uint8_t> padding(align_to_page(offset) - offset, 0);
+    bool ok = write_all(fd, padding.data(), padding.size());
+    offset += padding.size();
+
+    ok = ok && write_all(fd, &header, sizeof(header));
+    ok = ok && write_all(fd, indices.data(), indices.size() * sizeof(uint16_t));
+    offset += sizeof(header) + indices.size() * sizeof(uint16_t);
+
+    padding.assign(align_to_page(offset) - offset, 0);
+    ok = ok && write_all(fd, padding.data(), padding.size());
+
+    for (uint16_t page : indices)
+    {
+        ok = ok && write_all(fd, memory.get_page(page), PAGE_SIZE);
+    }
+    ok = ok && write_all(fd, device_state.data(), device_state.size());
+    ok = close(fd) == 0 && ok;
+
+    if (ok && !append)
+    {
+        ok = rename(target.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        LOG_WARN("Could not write save state " + path);
+        return false;
+    }
+
+    // Later saves extend this file with the pages written from here on
+    append = true;
+    memory.mark_clean();
+    return true;
+}
+
+bool load_save_state(const std::string &path, Processor &cpu)
+{
+    std::shared_ptr<MappedFile> file = MappedFile::open(path);
+    if (!file)
+    {
+        LOG_WARN("Could not map save state " + path);
+        return false;
+    }
+    size_t size = file->size();
+
+    // Latest copy of each page and the last segment's header and device state
+    const uint8_t *pages[PAGE_COUNT] = {};
+    const SegmentHeader *last = nullptr;
+    const uint8_t *device_state = nullptr;
+
+    size_t offset = 0;
+    while (offset + sizeof(SegmentHeader) <= size)
+    {
+        const SegmentHeader *header = reinterpret_cast<const SegmentHeader *>(file->data() + offset);
+        if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(header->magic)) != 0)
+        {
+            LOG_WARN("Save state " + path + " has an unknown segment format");
+            return false;
+        }
+        if (header->version != SAVE_STATE_VERSION)
+        {
+            LOG_WARN("Save state " + path + " is version " + std::to_string(header->version) + ", this build reads version " +
+                     std::to_string(SAVE_STATE_VERSION));
+            return false;
+        }
+
+        size_t indices_offset = offset + sizeof(SegmentHeader);
+        size_t pages_offset = align_to_page(indices_offset + header->page_count * sizeof(uint16_t));
+        size_t end = pages_offset + header->page_count * PAGE_SIZE + header->device_state_size;
+        if (end > size)
+        {
+            LOG_WARN("Save state " + path + " is truncated");
+            return false;
+        }
+
+        const uint16_t *indices = reinterpret_cast<const uint16_t *>(file->data() + indices_offset);
+        for (uint32_t i = 0; i < header->page_count; i++)
+        {
+            pages[indices[i] % PAGE_COUNT] = file->data() + pages_offset + i * PAGE_SIZE;
+        }
+
+        last = header;
+        device_state = file->data() + pages_offset + header->page_count * PAGE_SIZE;
+        offset = align_to_page(end);
+    }
+
+    if (!last)
+    {
+        LOG_WARN("Save state " + path + " is empty");
+        return false;
+    }
+
+    ByteCodeMemory &memory = cpu.get_memory();
+    if (!memory.load_device_state(device_state, last->device_state_size))
+    {
+        LOG_WARN("Save state " + path + " does not match the attached devices");
+        return false;
+    }
+
+    for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+        if (memory.is_external(page))
+        {
+            continue;
+        }
+        if (pages[page])
+        {
+            // No copy until the page is written
+            memory.map_page(page, MappedFile::page(file, pages[page] - file->data()));
+        }
+        else
+        {
+            memory.map_page(page, PageCache::zero_page());
+        }
+    }
+    memory.mark_clean();
+
+    cpu.set_registers({last->A, last->X, last->Y, last->status, last->PC, last->SP});
+    cpu.set_cycles(last->cycles);
+    return true;
+}
@@ -0,0 +1,296 @@
+#include "serial_input.h"
+#include "logging.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Register offsets
+static constexpr uint8_t SERIAL_DATA = 0;
+static constexpr uint8_t SERIAL_STATUS = 1;
+static constexpr uint8_t SERIAL_COUNT = 2;
+static constexpr uint8_t SERIAL_CONTROL = 3;
+
+static constexpr uint8_t STATUS_AVAILABLE = 0x01;
+static constexpr uint8_t STATUS_END = 0x80;
+static constexpr uint8_t CONTROL_IRQ = 0x01;
+
+// Bytes moved per read from a source
+static constexpr size_t READ_CHUNK = 64 * 1024;
+
+// Backstop for a wake up lost between the reactor checking for room and going to sleep
+static constexpr int ROOM_POLL_MS = 10;
+
+SerialInputDevice::SerialInputDevice(size_t queue_capacity) : queue(queue_capacity)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = UINT32_MAX;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+}
+
+SerialInputDevice::~SerialInputDevice()
+{
+    stop();
+    for (Source &source : sources)
+    {
+        if (source.fd > STDIN_FILENO)
+        {
+            close(source.fd);
+        }
+    }
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+bool SerialInputDevice::open(const std::string &path)
+{
+    int fd = STDIN_FILENO;
+    if (path != "-")
+    {
+        // A FIFO opened for writing too never reports the end when its last writer leaves
+        struct stat info;
+        bool fifo = stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+        fd = ::open(path.c_str(), (fifo ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+        {
+            LOG_WARN("Cannot open input " + path + ": " + strerror(errno));
+            return false;
+        }
+    }
+    else
+    {
+        if (stdin_flags < 0)
+        {
+            stdin_flags = fcntl(fd, F_GETFL);
+        }
+        fcntl(fd, F_SETFL, stdin_flags | O_NONBLOCK);
+    }
+
+    // Regular files cannot be watched, they are always ready
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = sources.size();
+    bool pollable = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    if (!pollable && errno != EPERM)
+    {
+        LOG_WARN("Cannot watch input " + path + ": " + strerror(errno));
+        return false;
+    }
+    sources.push_back({fd, pollable});
+    finished = false;
+    return true;
+}
+
+void SerialInputDevice::start()
+{
+    if (!reactor.joinable())
+    {
+        stopping = false;
+        reactor = std::thread(&SerialInputDevice::run, this);
+    }
+}
+
+void SerialInputDevice::stop()
+{
+    if (reactor.joinable())
+    {
+        stopping = true;
+        uint64_t one = 1;
+        ::write(wake_fd, &one, sizeof(one));
+        reactor.join();
+    }
+
+    // Otherwise the shell is left with a non-blocking terminal
+    if (stdin_flags >= 0)
+    {
+        fcntl(STDIN_FILENO, F_SETFL, stdin_flags);
+        stdin_flags = -1;
+    }
+}
+
+void SerialInputDevice::run()
+{
+    size_t open_sources = sources.size();
+    while (!stopping && open_sources > 0)
+    {
+        // Full: sleep until the program drained half of the queue
+        if (queue.free_space() == 0)
+        {
+            waiting_for_room = true;
+            pollfd wake = {wake_fd, POLLIN, 0};
+            poll(&wake, 1, ROOM_POLL_MS);
+            uint64_t count;
+            ::read(wake_fd, &count, sizeof(count));
+            waiting_for_room = false;
+            continue;
+        }
+
+        bool files_ready = false;
+        for (const Source &source : sources)
+        {
+            files_ready = files_ready || (source.fd >= 0 && !source.pollable);
+        }
+
+        epoll_event events[16];
+        int ready = epoll_wait(epoll_fd, events, 16, files_ready ? 0 : -1);
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.u32 == UINT32_MAX)
+            {
+                uint64_t count;
+                ::read(wake_fd, &count, sizeof(count));
+                continue;
+            }
+            Source &source = sources[events[i].data.u32];
+            if (source.fd >= 0 && !drain(source))
+            {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source.fd, nullptr);
+                if (source.fd > STDIN_FILENO)
+                {
+                    close(source.fd);
+                }
+                source.fd = -1;
+                open_sources--;
+            }
+        }
+
+        for (Source &source : sources)
+        {
+            if (source.fd >= 0 && !source.pollable && !drain(source))
+            {
+                if (source.fd > STDIN_FILENO)
+                {
+                    close(source.fd);
+                }
+                source.fd = -1;
+                open_sources--;
+            }
+        }
+    }
+    finished = open_sources == 0;
+}
+
+bool SerialInputDevice::drain(Source &source)
+{
+    uint8_t chunk[READ_CHUNK];
+    size_t room = std::min(queue.free_space(), READ_CHUNK);
+    if (room == 0)
+    {
+        return true;
+    }
+
+    ssize_t count = ::read(source.fd, chunk, room);
+    if (count == 0)
+    {
+        return false;
+    }
+    if (count < 0)
+    {
+        return errno == EAGAIN || errno == EINTR;
+    }
+
+    queue.push(chunk, count);
+    received.fetch_add(count, std::memory_order_relaxed);
+    if (bus && irq_enabled.load(std::memory_order_relaxed))
+    {
+        bus->raise_irq(SERIAL_IRQ);
+    }
+    return true;
+}
+
+void SerialInputDevice::connect(ByteCodeMemory *memory)
+{
+    bus = memory;
+}
+
+void SerialInputDevice::write(uint16_t address, uint8_t value)
+{
+    if ((address & 0xFF) == SERIAL_CONTROL)
+    {
+        control = value;
+        irq_enabled = value & CONTROL_IRQ;
+        update_irq();
+    }
+}
+
+uint8_t SerialInputDevice::read(uint16_t address)
+{
+    switch (address & 0xFF)
+    {
+    case SERIAL_DATA:
+    {
+        uint8_t value = 0;
+        if (!queue.pop(value))
+        {
+            return 0;
+        }
+        if (waiting_for_room.load(std::memory_order_relaxed) && queue.size() <= queue.capacity() / 2 &&
+            waiting_for_room.exchange(false))
+        {
+            uint64_t one = 1;
+            ::write(wake_fd, &one, sizeof(one));
+        }
+        if (control & CONTROL_IRQ)
+        {
+            update_irq();
+        }
+        return value;
+    }
+    case SERIAL_STATUS:
+    {
+        bool available = queue.size() > 0;
+        return (available ? STATUS_AVAILABLE : 0) | (!available && finished ? STATUS_END : 0);
+    }
+    case SERIAL_COUNT:
+        return std::min<size_t>(queue.size(), 0xFF);
+    case SERIAL_CONTROL:
+        return control;
+    default:
+        return 0;
+    }
+}
+
+void SerialInputDevice::update_irq()
+{
+    if (!bus)
+    {
+        return;
+    }
+
+    // Cleared first, so a byte the reactor pushes meanwhile raises it again
+    bus->clear_irq(SERIAL_IRQ);
+    if ((control & CONTROL_IRQ) && queue.size() > 0)
+    {
+        bus->raise_irq(SERIAL_IRQ);
+    }
+}
+
+uint64_t SerialInputDevice::get_received() const
+{
+    return received.load(std::memory_order_relaxed);
+}
+
+void SerialInputDevice::save_state(std::vector<uint8_t> &out) const
+{
+    out.push_back(control);
+}
+
+bool SerialInputDevice::load_state(const uint8_t *data, size_t size)
+{
+    if (size != 1)
+    {
+        return false;
+    }
+    control = data[0];
+    irq_enabled = control & CONTROL_IRQ;
+    update_irq();
+    return true;
+}
@@ -0,0 +1,236 @@
+#include "state_export.h"
+#include "logging.h"
+#include "processor.h"
+#include "input_log.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+// Attempts before a reader gives up on a segment that keeps changing under it
+static constexpr int READ_ATTEMPTS = 64;
+
+static uint64_t now_ns(clockid_t clock)
+{
+    timespec now;
+    clock_gettime(clock, &now);
+    return uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+// Seqlock read of a segment, shared by readers in and out of process
+static bool read_segment(const ExportedStateSegment *segment, ExportedState &state)
+{
+    if (!segment)
+    {
+        return false;
+    }
+
+    for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+    {
+        uint32_t before = segment->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            continue;
+        }
+
+        state.pid = segment->pid;
+        state.cycles = segment->cycles.load(std::memory_order_relaxed);
+        state.instructions = segment->instructions.load(std::memory_order_relaxed);
+        state.instructions_per_second = segment->instructions_per_second.load(std::memory_order_relaxed);
+        uint64_t registers = segment->registers.load(std::memory_order_relaxed);
+        state.updated_ns = segment->updated_ns.load(std::memory_order_relaxed);
+        state.device_count = std::min<uint64_t>(segment->device_count.load(std::memory_order_relaxed), EXPORTED_DEVICE_COUNT);
+        for (uint64_t i = 0; i < state.device_count; i++)
+        {
+            state.device_accesses[i] = segment->device_accesses[i].load(std::memory_order_relaxed);
+            uint64_t name[EXPORTED_NAME_WORDS];
+            for (uint32_t word = 0; word < EXPORTED_NAME_WORDS; word++)
+            {
+                name[word] = segment->device_names[i][word].load(std::memory_order_relaxed);
+            }
+            memcpy(state.device_names[i], name, sizeof(name));
+            state.device_names[i][sizeof(name)] = '\0';
+        }
+        state.interrupts = segment->interrupts.load(std::memory_order_relaxed);
+        state.input_log_bytes = segment->input_log_bytes.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->sequence.load(std::memory_order_relaxed) != before)
+        {
+            continue;
+        }
+
+        state.A = registers & 0xFF;
+        state.X = (registers >> 8) & 0xFF;
+        state.Y = (registers >> 16) & 0xFF;
+        state.status = (registers >> 24) & 0xFF;
+        state.SP = (registers >> 32) & 0xFF;
+        state.PC = (registers >> 40) & 0xFFFF;
+        return true;
+    }
+    return false;
+}
+
+StateExporter::StateExporter(const std::string &name, bool shared)
+    : name(name), shared(shared), segment(nullptr), last_instructions(0), last_ns(now_ns(CLOCK_MONOTONIC))
+{
+    if (!shared)
+    {
+        segment = new ExportedStateSegment();
+        segment->version = STATE_EXPORT_VERSION;
+        segment->pid = getpid();
+        memcpy(segment->magic, STATE_EXPORT_MAGIC, sizeof(segment->magic));
+        return;
+    }
+
+    if (this->name.empty())
+    {
+        this->name = "/emu6502-" + std::to_string(getpid());
+    }
+
+    int fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(ExportedStateSegment)) != 0)
+    {
+        LOG_WARN("Could not create shared memory segment " + this->name);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    void *data = mmap(nullptr, sizeof(ExportedStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        LOG_WARN("Could not map shared memory segment " + this->name);
+        shm_unlink(this->name.c_str());
+        return;
+    }
+
+    // The truncated segment is zero filled, which is a valid even sequence
+    segment = static_cast<ExportedStateSegment *>(data);
+    segment->version = STATE_EXPORT_VERSION;
+    segment->pid = getpid();
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(segment->magic, STATE_EXPORT_MAGIC, sizeof(segment->magic));
+}
+
+StateExporter::~StateExporter()
+{
+    if (segment && !shared)
+    {
+        delete segment;
+    }
+    else if (segment)
+    {
+        munmap(segment, sizeof(ExportedStateSegment));
+        shm_unlink(name.c_str());
+    }
+}
+
+bool StateExporter::is_open() const
+{
+    return segment != nullptr;
+}
+
+const std::string &StateExporter::get_name() const
+{
+    return name;
+}
+
+void StateExporter::publish(Processor &cpu)
+{
+    if (!segment)
+    {
+        return;
+    }
+
+    Registers registers = cpu.get_registers();
+    uint64_t instructions = cpu.get_instructions();
+    uint64_t ns = now_ns(CLOCK_MONOTONIC);
+    uint64_t rate = ns > last_ns ? (instructions - last_instructions) * 1000000000ULL / (ns - last_ns) : 0;
+    last_instructions = instructions;
+    last_ns = ns;
+
+    std::vector<DeviceAccesses> accesses;
+    cpu.get_memory().get_device_accesses(accesses);
+    size_t device_count = std::min<size_t>(accesses.size(), EXPORTED_DEVICE_COUNT);
+
+    uint32_t sequence = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    segment->cycles.store(cpu.get_cycles(), std::memory_order_relaxed);
+    segment->instructions.store(instructions, std::memory_order_relaxed);
+    segment->instructions_per_second.store(rate, std::memory_order_relaxed);
+    segment->registers.store(uint64_t(registers.PC) << 40 | uint64_t(registers.SP) << 32 | uint64_t(registers.status) << 24 |
+                                 uint64_t(registers.Y) << 16 | uint64_t(registers.X) << 8 | registers.A,
+                             std::memory_order_relaxed);
+    segment->updated_ns.store(now_ns(CLOCK_REALTIME), std::memory_order_relaxed);
+    segment->device_count.store(device_count, std::memory_order_relaxed);
+    for (size_t i = 0; i < device_count; i++)
+    {
+        segment->device_accesses[i].store(accesses[i].count, std::memory_order_relaxed);
+        uint64_t name[EXPORTED_NAME_WORDS] = {};
+        strncpy(reinterpret_cast<char *>(name), accesses[i].name, sizeof(name));
+        for (uint32_t word = 0; word < EXPORTED_NAME_WORDS; word++)
+        {
+            segment->device_names[i][word].store(name[word], std::memory_order_relaxed);
+        }
+    }
+    segment->interrupts.store(cpu.get_interrupts(), std::memory_order_relaxed);
+    InputLog *log = cpu.get_memory().get_input_log();
+    segment->input_log_bytes.store(log ? log->size_bytes() : 0, std::memory_order_relaxed);
+
+    segment->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool StateExporter::read(ExportedState &state) const
+{
+    return read_segment(segment, state);
+}
+
+StateReader::StateReader(const std::string &name) : segment(nullptr)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    void *data = mmap(nullptr, sizeof(ExportedStateSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return;
+    }
+
+    segment = static_cast<const ExportedStateSegment *>(data);
+    if (memcmp(segment->magic, STATE_EXPORT_MAGIC, sizeof(segment->magic)) != 0 || segment->version != STATE_EXPORT_VERSION)
+    {
+        munmap(const_cast<ExportedStateSegment *>(segment), sizeof(ExportedStateSegment));
+        segment = nullptr;
+    }
+}
+
+StateReader::~StateReader()
+{
+    if (segment)
+    {
+        munmap(const_cast<ExportedStateSegment *>(segment), sizeof(ExportedStateSegment));
+    }
+}
+
+bool StateReader::is_open() const
+{
+    return segment != nullptr;
+}
+
+bool StateReader::read(ExportedState &state) const
+{
+    return read_segment(segment, state);
+}
@@ -0,0 +1,144 @@
+#include "stats_reporter.h"
+#include "logging.h"
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+static void metric(std::ostringstream &out, const char *name, const char *type, const char *help)
+{
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+// Devices are labelled by name, so series survive changes to the attach order. Repeated
+// names get "#2", "#3", ... in attach order.
+static std::vector<std::string> device_labels(const ExportedState &state)
+{
+    std::vector<std::string> labels;
+    std::map<std::string, int> seen;
+    for (uint64_t i = 0; i < state.device_count; i++)
+    {
+        std::string name = state.device_names[i];
+        int count = ++seen[name];
+        labels.push_back(count == 1 ? name : name + "#" + std::to_string(count));
+    }
+    return labels;
+}
+
+StatsReporter::StatsReporter(const StateExporter &source, std::chrono::milliseconds interval, const std::string &path)
+    : source(source), interval(interval), path(path), stopping(false), have_previous(false) {}
+
+StatsReporter::~StatsReporter()
+{
+    stop();
+}
+
+void StatsReporter::start()
+{
+    if (!thread.joinable())
+    {
+        stopping = false;
+        thread = std::thread(&StatsReporter::run, this);
+    }
+}
+
+void StatsReporter::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+    report();
+}
+
+void StatsReporter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this]()
+                          { return stopping; }))
+    {
+        lock.unlock();
+        report();
+        lock.lock();
+    }
+}
+
+void StatsReporter::report()
+{
+    ExportedState state;
+    if (!source.read(state))
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    double seconds = have_previous ? std::chrono::duration<double>(now - previous_time).count() : 0;
+    auto rate = [&](uint64_t current, uint64_t last)
+    { return seconds > 0 ? (current - last) / seconds : 0.0; };
+
+    timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    uint64_t now_ns = uint64_t(realtime.tv_sec) * 1000000000ULL + realtime.tv_nsec;
+
+    std::ostringstream out;
+    metric(out, "emu6502_instructions_total", "counter", "Instructions retired.");
+    out << "emu6502_instructions_total " << state.instructions << "\n";
+    metric(out, "emu6502_cycles_total", "counter", "Emulated cycles.");
+    out << "emu6502_cycles_total " << state.cycles << "\n";
+    metric(out, "emu6502_instructions_per_second", "gauge", "Instructions retired per second over the last interval.");
+    out << "emu6502_instructions_per_second " << rate(state.instructions, previous.instructions) << "\n";
+    metric(out, "emu6502_emulated_mhz", "gauge", "Emulated clock rate over the last interval.");
+    out << "emu6502_emulated_mhz " << rate(state.cycles, previous.cycles) / 1e6 << "\n";
+
+    std::vector<std::string> labels = device_labels(state);
+    metric(out, "emu6502_device_accesses_total", "counter", "Reads and writes seen by each device.");
+    for (uint64_t i = 0; i < state.device_count; i++)
+    {
+        out << "emu6502_device_accesses_total{device=\"" << labels[i] << "\"} " << state.device_accesses[i] << "\n";
+    }
+    metric(out, "emu6502_device_accesses_per_second", "gauge", "Device I/O rate over the last interval.");
+    for (uint64_t i = 0; i < state.device_count; i++)
+    {
+        uint64_t last = i < previous.device_count ? previous.device_accesses[i] : 0;
+        out << "emu6502_device_accesses_per_second{device=\"" << labels[i] << "\"} " << rate(state.device_accesses[i], last) << "\n";
+    }
+
+    metric(out, "emu6502_interrupts_total", "counter", "IRQs taken.");
+    out << "emu6502_interrupts_total " << state.interrupts << "\n";
+    metric(out, "emu6502_input_log_bytes", "gauge", "Size of the record/replay input log.");
+    out << "emu6502_input_log_bytes " << state.input_log_bytes << "\n";
+
+    // A CPU thread that stopped publishing shows up as a growing age
+    metric(out, "emu6502_update_age_seconds", "gauge", "Time since the processor last published its state.");
+    out << "emu6502_update_age_seconds " << (now_ns > state.updated_ns && state.updated_ns ? (now_ns - state.updated_ns) / 1e9 : 0.0) << "\n";
+
+    previous = state;
+    previous_time = now;
+    have_previous = true;
+
+    std::string text = out.str();
+    if (path.empty())
+    {
+        std::cerr << text << std::flush;
+        return;
+    }
+
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temporary.c_str(), "w");
+    bool ok = file && fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = file && fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        LOG_WARN("Could not write stats to " + path);
+    }
+}
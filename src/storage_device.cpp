@@ -0,0 +1,469 @@
+#include "storage_device.h"
+#include "input_log.h"
+#include "logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Register offsets
+static constexpr uint8_t STORAGE_SECTOR = 0;
+static constexpr uint8_t STORAGE_ADDRESS = 4;
+static constexpr uint8_t STORAGE_COMMAND = 6;
+static constexpr uint8_t STORAGE_STATUS = 7;
+static constexpr uint8_t STORAGE_CONTROL = 8;
+
+static constexpr uint8_t STATUS_BUSY = 0x80;
+static constexpr uint8_t STATUS_DONE = 0x02;
+static constexpr uint8_t STATUS_ERROR = 0x01;
+static constexpr uint8_t CONTROL_IRQ = 0x01;
+
+// Logged outcomes of poll
+static constexpr uint64_t POLL_BUSY = 0;
+static constexpr uint64_t POLL_DONE = 1;
+static constexpr uint64_t POLL_FAILED = 2;
+
+StorageDevice::StorageDevice(uint32_t sector_size, uint32_t read_ahead, size_t cache_sectors)
+    : sector_size(sector_size == 512 ? 512 : 256), read_ahead(read_ahead),
+      cache_sectors(std::max<size_t>(cache_sectors, read_ahead + 2)), fd(-1) {}
+
+StorageDevice::~StorageDevice()
+{
+    if (worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+bool StorageDevice::open(const std::string &path)
+{
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_WARN("Cannot open storage image " + path + ": " + strerror(errno));
+        return false;
+    }
+    worker = std::thread(&StorageDevice::work, this);
+    return true;
+}
+
+void StorageDevice::connect(ByteCodeMemory *memory)
+{
+    bus = memory;
+}
+
+void StorageDevice::write(uint16_t address, uint8_t value)
+{
+    uint8_t reg = address & 0xFF;
+    if (reg == STORAGE_COMMAND)
+    {
+        registers[reg] = value;
+        start(static_cast<StorageCommand>(value));
+    }
+    else if (reg == STORAGE_CONTROL)
+    {
+        registers[reg] = value;
+        irq_enabled = value & CONTROL_IRQ;
+    }
+    else if (reg < STORAGE_COMMAND)
+    {
+        registers[reg] = value;
+    }
+}
+
+uint8_t StorageDevice::read(uint16_t address)
+{
+    uint8_t reg = address & 0xFF;
+    if (reg == STORAGE_STATUS)
+    {
+        uint8_t status = poll();
+        if (bus && !(status & STATUS_BUSY))
+        {
+            bus->clear_irq(STORAGE_IRQ);
+        }
+        return status;
+    }
+    return reg < sizeof(registers) ? registers[reg] : 0;
+}
+
+void StorageDevice::replay_read(uint16_t address)
+{
+    // The status read polled in the recording, which logged its outcome
+    if ((address & 0xFF) == STORAGE_STATUS)
+    {
+        read(address);
+    }
+}
+
+void StorageDevice::start(StorageCommand command)
+{
+    // One command at a time
+    if (fd < 0 || !bus || (poll() & STATUS_BUSY))
+    {
+        return;
+    }
+
+    uint32_t sector = registers[STORAGE_SECTOR] | registers[STORAGE_SECTOR + 1] << 8 |
+                      registers[STORAGE_SECTOR + 2] << 16 | uint32_t(registers[STORAGE_SECTOR + 3]) << 24;
+    uint16_t address = registers[STORAGE_ADDRESS] | registers[STORAGE_ADDRESS + 1] << 8;
+    registers[STORAGE_STATUS] = 0;
+    bus->clear_irq(STORAGE_IRQ);
+
+    InputLog *log = bus->get_input_log();
+    bool replaying = is_replaying();
+
+    switch (command)
+    {
+    case StorageCommand::READ:
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Sector *cached = nullptr;
+        if (!replaying)
+        {
+            queue_prefetch(sector);
+            cached = lookup(sector);
+        }
+
+        // Hits depend on how far the worker got, replays take the recorded answer
+        bool hit = cached != nullptr;
+        if (log)
+        {
+            hit = log->host_value(hit) != 0;
+        }
+        if (hit)
+        {
+            hits++;
+            transfer_data = cached ? cached->data : std::vector<uint8_t>(sector_size, 0);
+            lock.unlock();
+            wake.notify_one();
+            transfer_in(address, transfer_data);
+            complete(false);
+            return;
+        }
+
+        misses++;
+        transfer_sector = sector;
+        transfer_address = address;
+        pending_command = command;
+        if (!replaying)
+        {
+            pending.store(Pending::READ, std::memory_order_release);
+        }
+        registers[STORAGE_STATUS] = STATUS_BUSY;
+        lock.unlock();
+        wake.notify_one();
+        return;
+    }
+    case StorageCommand::WRITE:
+    {
+        // Write-back: complete once cached. Replays do not write the image again.
+        std::vector<uint8_t> data(sector_size);
+        bus->read_block(address, data.data(), sector_size);
+        if (!replaying)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            insert(sector, std::move(data), true);
+        }
+        wake.notify_one();
+        complete(false);
+        return;
+    }
+    case StorageCommand::FLUSH:
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending_command = command;
+        if (!replaying)
+        {
+            pending.store(Pending::FLUSH, std::memory_order_release);
+        }
+        registers[STORAGE_STATUS] = STATUS_BUSY;
+        wake.notify_one();
+        return;
+    }
+    default:
+        return;
+    }
+}
+
+uint8_t StorageDevice::poll()
+{
+    if (!(registers[STORAGE_STATUS] & STATUS_BUSY))
+    {
+        return registers[STORAGE_STATUS];
+    }
+
+    Pending state = pending.load(std::memory_order_acquire);
+    uint64_t outcome = state == Pending::COMPLETED ? POLL_DONE : state == Pending::FAILED ? POLL_FAILED : POLL_BUSY;
+
+    // When the worker finishes is timing, replays take the recorded outcome
+    if (InputLog *log = bus->get_input_log())
+    {
+        outcome = log->host_value(outcome);
+    }
+    if (outcome == POLL_BUSY)
+    {
+        return registers[STORAGE_STATUS];
+    }
+
+    if (outcome == POLL_DONE && pending_command == StorageCommand::READ)
+    {
+        transfer_in(transfer_address, transfer_data);
+    }
+    pending.store(Pending::NONE, std::memory_order_relaxed);
+    registers[STORAGE_STATUS] = STATUS_DONE | (outcome == POLL_FAILED ? STATUS_ERROR : 0);
+    return registers[STORAGE_STATUS];
+}
+
+void StorageDevice::transfer_in(uint16_t address, std::vector<uint8_t> &data)
+{
+    // The sector is input: the image may have changed since it was recorded
+    if (InputLog *log = bus->get_input_log())
+    {
+        log->block(data.data(), data.size());
+    }
+    bus->write_block(address, data.data(), data.size());
+}
+
+bool StorageDevice::is_replaying() const
+{
+    InputLog *log = bus ? bus->get_input_log() : nullptr;
+    return log && log->is_replaying();
+}
+
+void StorageDevice::complete(bool error)
+{
+    registers[STORAGE_STATUS] = STATUS_DONE | (error ? STATUS_ERROR : 0);
+    if (irq_enabled)
+    {
+        bus->raise_irq(STORAGE_IRQ);
+    }
+}
+
+void StorageDevice::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]()
+                  { return stopping || pending == Pending::READ || pending == Pending::FLUSH || !prefetch.empty() || dirty_count > 0; });
+
+        // Demand reads first, then read-ahead, then writes
+        if (pending == Pending::READ)
+        {
+            bool ok = true;
+            uint32_t sector = transfer_sector;
+            if (!lookup(sector))
+            {
+                std::vector<uint8_t> data;
+                lock.unlock();
+                ok = load(sector, data);
+                lock.lock();
+                if (ok && !lookup(sector))
+                {
+                    insert(sector, std::move(data), false);
+                }
+            }
+            if (ok)
+            {
+                transfer_data = lookup(sector)->data;
+            }
+            pending.store(ok ? Pending::COMPLETED : Pending::FAILED, std::memory_order_release);
+            if (irq_enabled)
+            {
+                bus->raise_irq(STORAGE_IRQ);
+            }
+            continue;
+        }
+
+        if (!prefetch.empty() && !stopping)
+        {
+            uint32_t sector = prefetch.front();
+            prefetch.erase(prefetch.begin());
+            if (!lookup(sector))
+            {
+                std::vector<uint8_t> data;
+                lock.unlock();
+                bool ok = load(sector, data);
+                lock.lock();
+                if (ok && !lookup(sector))
+                {
+                    insert(sector, std::move(data), false);
+                }
+            }
+            continue;
+        }
+
+        if (pending == Pending::FLUSH)
+        {
+            bool ok = write_back(lock, true);
+            lock.unlock();
+            ok = fdatasync(fd) == 0 && ok;
+            lock.lock();
+            pending.store(ok ? Pending::COMPLETED : Pending::FAILED, std::memory_order_release);
+            if (irq_enabled)
+            {
+                bus->raise_irq(STORAGE_IRQ);
+            }
+            continue;
+        }
+
+        if (stopping)
+        {
+            prefetch.clear();
+            write_back(lock, true);
+            return;
+        }
+
+        if (dirty_count > 0 && !write_back(lock, false))
+        {
+            // Retried on the next flush instead of spinning on a failing image
+            LOG_WARN("Storage write-back failed: " + std::string(strerror(errno)));
+            wake.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+}
+
+StorageDevice::Sector *StorageDevice::lookup(uint32_t sector)
+{
+    auto found = cache.find(sector);
+    if (found == cache.end())
+    {
+        return nullptr;
+    }
+    recent.splice(recent.begin(), recent, found->second.lru);
+    return &found->second;
+}
+
+void StorageDevice::insert(uint32_t sector, std::vector<uint8_t> data, bool dirty)
+{
+    if (Sector *cached = lookup(sector))
+    {
+        dirty_count += dirty && !cached->dirty;
+        cached->data = std::move(data);
+        cached->dirty = cached->dirty || dirty;
+        return;
+    }
+
+    // Evict the least recently used clean sectors, dirty ones stay until written back
+    for (auto victim = recent.end(); cache.size() >= cache_sectors && victim != recent.begin();)
+    {
+        --victim;
+        if (!cache[*victim].dirty)
+        {
+            cache.erase(*victim);
+            victim = recent.erase(victim);
+        }
+    }
+
+    recent.push_front(sector);
+    cache[sector] = {std::move(data), dirty, recent.begin()};
+    dirty_count += dirty;
+}
+
+void StorageDevice::queue_prefetch(uint32_t sector)
+{
+    for (uint32_t next = 1; next <= read_ahead; next++)
+    {
+        if (!cache.count(sector + next) && std::find(prefetch.begin(), prefetch.end(), sector + next) == prefetch.end())
+        {
+            prefetch.push_back(sector + next);
+        }
+    }
+}
+
+bool StorageDevice::load(uint32_t sector, std::vector<uint8_t> &data)
+{
+    // Past the end of the image reads as zeros
+    data.assign(sector_size, 0);
+    ssize_t count = pread(fd, data.data(), sector_size, off_t(sector) * sector_size);
+    return count >= 0;
+}
+
+bool StorageDevice::write_back(std::unique_lock<std::mutex> &lock, bool all)
+{
+    std::vector<uint32_t> dirty;
+    for (const auto &entry : cache)
+    {
+        if (entry.second.dirty)
+        {
+            dirty.push_back(entry.first);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end());
+
+    for (uint32_t sector : dirty)
+    {
+        auto found = cache.find(sector);
+        if (found == cache.end() || !found->second.dirty)
+        {
+            continue;
+        }
+
+        // Marked clean before writing, a write meanwhile makes it dirty again
+        std::vector<uint8_t> data = found->second.data;
+        found->second.dirty = false;
+        dirty_count--;
+
+        lock.unlock();
+        bool ok = pwrite(fd, data.data(), sector_size, off_t(sector) * sector_size) == ssize_t(sector_size);
+        lock.lock();
+        if (!ok)
+        {
+            found = cache.find(sector);
+            if (found != cache.end() && !found->second.dirty)
+            {
+                found->second.dirty = true;
+                dirty_count++;
+            }
+            return false;
+        }
+        if (!all)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+uint64_t StorageDevice::get_cache_hits() const
+{
+    return hits;
+}
+
+uint64_t StorageDevice::get_cache_misses() const
+{
+    return misses;
+}
+
+void StorageDevice::save_state(std::vector<uint8_t> &out) const
+{
+    out.insert(out.end(), registers, registers + sizeof(registers));
+}
+
+bool StorageDevice::load_state(const uint8_t *data, size_t size)
+{
+    if (size != sizeof(registers))
+    {
+        return false;
+    }
+    memcpy(registers, data, sizeof(registers));
+    irq_enabled = registers[STORAGE_CONTROL] & CONTROL_IRQ;
+
+    // A command in flight when the state was saved is issued again
+    if (registers[STORAGE_STATUS] & STATUS_BUSY)
+    {
+        registers[STORAGE_STATUS] = 0;
+        start(static_cast<StorageCommand>(registers[STORAGE_COMMAND]));
+    }
+    return true;
+}
@@ -0,0 +1,100 @@
+// Samples the state exported by running emulators (see state_export.h).
+//
+//   emu6502_stat [--interval ms] [--count N] [--json] [segment...]
+//
+// Without segment names every /dev/shm/emu6502-* segment is sampled. Reading never blocks
+// the emulators.
+#include "state_export.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::vector<std::string> find_segments()
+{
+    std::vector<std::string> names;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator("/dev/shm", error))
+    {
+        std::string file = entry.path().filename().string();
+        if (file.rfind("emu6502-", 0) == 0)
+        {
+            names.push_back("/" + file);
+        }
+    }
+    return names;
+}
+
+static void print_state(const std::string &name, const ExportedState &state, bool json)
+{
+    if (json)
+    {
+        printf("{\"segment\": \"%s\", \"pid\": %u, \"cycles\": %llu, \"instructions\": %llu, \"ips\": %llu, "
+               "\"PC\": %u, \"A\": %u, \"X\": %u, \"Y\": %u, \"P\": %u, \"SP\": %u, \"device_accesses\": [",
+               name.c_str(), state.pid, (unsigned long long)state.cycles, (unsigned long long)state.instructions,
+               (unsigned long long)state.instructions_per_second, state.PC, state.A, state.X, state.Y, state.status, state.SP);
+        for (uint64_t i = 0; i < state.device_count; i++)
+        {
+            printf("%s%llu", i ? ", " : "", (unsigned long long)state.device_accesses[i]);
+        }
+        printf("], \"interrupts\": %llu}\n", (unsigned long long)state.interrupts);
+        return;
+    }
+
+    printf("%-20s pid %-7u PC=%04X A=%02X X=%02X Y=%02X P=%02X SP=%02X cycles %-12llu instructions %-12llu %8.2f MIPS devices",
+           name.c_str(), state.pid, state.PC, state.A, state.X, state.Y, state.status, state.SP,
+           (unsigned long long)state.cycles, (unsigned long long)state.instructions, state.instructions_per_second / 1e6);
+    for (uint64_t i = 0; i < state.device_count; i++)
+    {
+        printf(" %llu", (unsigned long long)state.device_accesses[i]);
+    }
+    printf(" irqs %llu\n", (unsigned long long)state.interrupts);
+}
+
+int main(int argc, char *argv[])
+{
+    int interval_ms = 1000;
+    int count = 1;
+    bool json = false;
+    std::vector<std::string> names;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--interval" && i + 1 < argc)
+            interval_ms = std::stoi(argv[++i]);
+        else if (arg == "--count" && i + 1 < argc)
+            count = std::stoi(argv[++i]);
+        else if (arg == "--json")
+            json = true;
+        else if (arg.rfind("--", 0) == 0)
+        {
+            fprintf(stderr, "Usage: %s [--interval ms] [--count N, 0 = forever] [--json] [segment...]\n", argv[0]);
+            return 1;
+        }
+        else
+            names.push_back(arg[0] == '/' ? arg : "/" + arg);
+    }
+
+    for (int sample = 0; count == 0 || sample < count; sample++)
+    {
+        if (sample > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        }
+
+        for (const std::string &name : names.empty() ? find_segments() : names)
+        {
+            StateReader reader(name);
+            ExportedState state;
+            if (reader.read(state))
+            {
+                print_state(name, state, json);
+            }
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+// Generates superinstructions.inc from opcode profiles written with --profile-out.
+//
+//   superinstruction_gen [--max N] <output.inc> <profile>...
+//
+// The most frequent opcode pairs (at least 0.1% of all pairs) become superinstructions, each extended by its most frequent
+// third opcode when that triple covers at least half of the pair's executions.
+#include "processor.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Sequence
+{
+    std::vector<uint8_t> opcodes;
+    uint64_t count;
+};
+
+// Only the last opcode of a superinstruction may leave the straight line path
+static bool is_control_flow(uint8_t opcode)
+{
+    switch (static_cast<OpCode>(opcode))
+    {
+    case OpCode::JMP_ABS:
+    case OpCode::JSR_ABS:
+    case OpCode::RTS:
+    case OpCode::RTI:
+    case OpCode::HOST_CALL:
+    case OpCode::BPL:
+    case OpCode::BMI:
+    case OpCode::BVC:
+    case OpCode::BVS:
+    case OpCode::BCC:
+    case OpCode::BCS:
+    case OpCode::BNE:
+    case OpCode::BEQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_fusable(const std::vector<uint8_t> &opcodes)
+{
+    for (size_t i = 0; i < opcodes.size(); i++)
+    {
+        // BRK halts in step() before dispatch, it never reaches a superinstruction
+        if (opcodes[i] == static_cast<uint8_t>(OpCode::BRK))
+            return false;
+        if (i + 1 < opcodes.size() && is_control_flow(opcodes[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool read_profile(const std::string &path, std::map<std::vector<uint8_t>, uint64_t> &counts)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "Cannot open profile " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        int length = 0;
+        fields >> length;
+        if (length < 2 || length > 3)
+            continue;
+
+        std::vector<uint8_t> opcodes;
+        for (int i = 0; i < length; i++)
+        {
+            unsigned int opcode = 0;
+            fields >> std::hex >> opcode;
+            opcodes.push_back(static_cast<uint8_t>(opcode));
+        }
+        uint64_t count = 0;
+        fields >> std::dec >> count;
+        if (fields)
+            counts[opcodes] += count;
+    }
+    return true;
+}
+
+static std::string opcode_literal(uint8_t opcode)
+{
+    char literal[32];
+    snprintf(literal, sizeof(literal), "static_cast<OpCode>(0x%02X)", opcode);
+    return literal;
+}
+
+static void write_chain(std::ostream &out, const std::vector<const Sequence *> &chains, size_t depth, int indent)
+{
+    std::string pad(indent, ' ');
+    for (size_t i = 0; i < chains.size(); i++)
+    {
+        // Chains are grouped by their prefix, emit each follower at this depth once
+        uint8_t opcode = chains[i]->opcodes[depth];
+        if (i > 0 && chains[i - 1]->opcodes[depth] == opcode)
+            continue;
+
+        std::vector<const Sequence *> longer;
+        for (size_t j = i; j < chains.size() && chains[j]->opcodes[depth] == opcode; j++)
+        {
+            if (chains[j]->opcodes.size() > depth + 1)
+                longer.push_back(chains[j]);
+        }
+
+        out << pad << (i > 0 ? "else if" : "if") << " (fuse_next(hooks, " << opcode_literal(opcode) << "))\n"
+            << pad << "{\n"
+            << pad << "    dispatch(hooks, " << opcode_literal(opcode) << ");\n";
+        if (!longer.empty())
+            write_chain(out, longer, depth + 1, indent + 4);
+        out << pad << "}\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_sequences = 16;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--max" && i + 1 < argc)
+            max_sequences = std::stoul(argv[++i]);
+        else
+            paths.push_back(arg);
+    }
+    if (paths.size() < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--max N] <output.inc> <profile>..." << std::endl;
+        return 1;
+    }
+
+    std::map<std::vector<uint8_t>, uint64_t> counts;
+    for (size_t i = 1; i < paths.size(); i++)
+    {
+        if (!read_profile(paths[i], counts))
+            return 1;
+    }
+
+    uint64_t total = 0;
+    for (const auto &entry : counts)
+    {
+        if (entry.first.size() == 2)
+            total += entry.second;
+    }
+
+    // Pairs under 0.1% of the executed pairs are not worth a case of their own
+    std::vector<Sequence> pairs;
+    for (const auto &entry : counts)
+    {
+        if (entry.first.size() == 2 && is_fusable(entry.first) && entry.second * 1000 >= total)
+            pairs.push_back({entry.first, entry.second});
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const Sequence &a, const Sequence &b) { return a.count > b.count; });
+    if (pairs.size() > max_sequences)
+        pairs.resize(max_sequences);
+
+    std::vector<Sequence> selected;
+    for (const Sequence &pair : pairs)
+    {
+        Sequence best = pair;
+        uint64_t best_count = 0;
+        for (const auto &entry : counts)
+        {
+            if (entry.first.size() == 3 && std::equal(pair.opcodes.begin(), pair.opcodes.end(), entry.first.begin()) &&
+                is_fusable(entry.first) && entry.second * 2 >= pair.count && entry.second > best_count)
+            {
+                best = {entry.first, entry.second};
+                best_count = entry.second;
+            }
+        }
+        selected.push_back(best);
+    }
+    // The switch and the fuse_next chains below walk sequences grouped by prefix
+    std::sort(selected.begin(), selected.end(), [](const Sequence &a, const Sequence &b) { return a.opcodes < b.opcodes; });
+
+    std::ofstream out(paths[0]);
+    if (!out)
+    {
+        std::cerr << "Cannot write " << paths[0] << std::endl;
+        return 1;
+    }
+
+    out << "// Generated by superinstruction_gen from opcode profiles. Do not edit.\n";
+    for (const Sequence &sequence : selected)
+    {
+        out << "//";
+        for (uint8_t opcode : sequence.opcodes)
+        {
+            char hex[4];
+            snprintf(hex, sizeof(hex), " %02X", opcode);
+            out << hex;
+        }
+        out << ": " << sequence.count << "\n";
+    }
+
+    out << "switch (opcode)\n{\n";
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+        uint8_t first = selected[i].opcodes[0];
+        if (i > 0 && selected[i - 1].opcodes[0] == first)
+            continue;
+
+        std::vector<const Sequence *> chains;
+        for (size_t j = i; j < selected.size() && selected[j].opcodes[0] == first; j++)
+            chains.push_back(&selected[j]);
+
+        out << "case " << opcode_literal(first) << ":\n"
+            << "    dispatch(hooks, " << opcode_literal(first) << ");\n";
+        write_chain(out, chains, 1, 4);
+        out << "    return true;\n";
+    }
+    out << "default:\n    return false;\n}\n";
+
+    std::cerr << "Wrote " << selected.size() << " superinstructions to " << paths[0] << std::endl;
+    return 0;
+}